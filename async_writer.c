@@ -0,0 +1,473 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "async_writer.h"
+#include "media_stats.h"
+
+//errors are negative errno values, the same numbers AVERROR(errno) gives
+
+typedef struct AwBuffer {
+    uint8_t *data;
+    size_t size;
+    off_t offset;
+    int in_flight;
+} AwBuffer;
+
+struct AsyncWriter {
+    int fd;
+    int direct;
+    int seekable;
+    enum AsyncWriterBackend backend;
+
+    AwBuffer *buffers;
+    int nb_buffers;
+    size_t buffer_size;
+
+    //buffer being filled by the producer
+    AwBuffer *current;
+    off_t offset;
+    int error;
+
+    //writer thread backend, buffers are written in submit order
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int *queue;
+    int queue_head;
+    int queue_len;
+    int thread_started;
+    int thread_error;
+    int quit;
+
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    int nb_in_flight;
+#endif
+};
+
+static int write_fully(AsyncWriter *w, const uint8_t *data, size_t size, off_t offset){
+    int64_t start = ms_timer_start();
+
+    ms_count(MS_BYTES_OUT, size);
+
+    while(size > 0){
+        ssize_t len = w->seekable ? pwrite(w->fd, data, size, offset)
+                                  : write(w->fd, data, size);
+        if(len < 0){
+            int err = errno;
+
+            if(err == EINTR){
+                continue;
+            }
+            ms_timer_stop(MS_IO, start);
+            return -err;
+        }
+
+        data += len;
+        size -= len;
+        offset += len;
+    }
+
+    ms_timer_stop(MS_IO, start);
+
+    return 0;
+}
+
+static void *writer_thread(void *arg){
+    AsyncWriter *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    while(1){
+        AwBuffer *buffer;
+        int ret;
+
+        while(!w->queue_len && !w->quit){
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+
+        if(!w->queue_len){
+            break;
+        }
+
+        buffer = &w->buffers[w->queue[w->queue_head]];
+        pthread_mutex_unlock(&w->lock);
+
+        ret = write_fully(w, buffer->data, buffer->size, buffer->offset);
+
+        pthread_mutex_lock(&w->lock);
+        if(ret < 0 && !w->thread_error){
+            w->thread_error = ret;
+        }
+        buffer->in_flight = 0;
+        w->queue_head = (w->queue_head + 1) % w->nb_buffers;
+        w->queue_len--;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+#ifdef HAVE_LIBURING
+//reap one completion, finishing short writes synchronously
+static int uring_reap(AsyncWriter *w){
+    struct io_uring_cqe *cqe;
+    AwBuffer *buffer;
+    int64_t start = ms_timer_start();
+    int ret;
+
+    ret = io_uring_wait_cqe(&w->ring, &cqe);
+    ms_timer_stop(MS_IO_WAIT, start);
+    if(ret < 0){
+        return ret;
+    }
+
+    buffer = &w->buffers[io_uring_cqe_get_data64(cqe)];
+    ret = cqe->res;
+    io_uring_cqe_seen(&w->ring, cqe);
+
+    //res is a negative errno or the bytes written, a short write is finished here
+    if(ret >= 0){
+        ms_count(MS_BYTES_OUT, ret);
+        if((size_t)ret < buffer->size){
+            ret = write_fully(w, buffer->data + ret, buffer->size - ret, buffer->offset + ret);
+        }
+    }
+
+    buffer->in_flight = 0;
+    w->nb_in_flight--;
+
+    return ret < 0 ? ret : 0;
+}
+
+static int uring_submit(AsyncWriter *w, AwBuffer *buffer){
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+    int index = buffer - w->buffers;
+
+    if(!sqe){
+        return -EBUSY;
+    }
+
+    io_uring_prep_write_fixed(sqe, w->fd, buffer->data, buffer->size, buffer->offset, index);
+    io_uring_sqe_set_data64(sqe, index);
+    buffer->in_flight = 1;
+    w->nb_in_flight++;
+
+    return io_uring_submit(&w->ring) < 0 ? -EIO : 0;
+}
+
+static int uring_init(AsyncWriter *w){
+    struct iovec *iovecs;
+    int ret;
+
+    ret = io_uring_queue_init(w->nb_buffers, &w->ring, 0);
+    if(ret < 0){
+        return ret;
+    }
+
+    //registered buffers save the kernel a page pin per write
+    iovecs = calloc(w->nb_buffers, sizeof(*iovecs));
+    if(!iovecs){
+        io_uring_queue_exit(&w->ring);
+        return -ENOMEM;
+    }
+
+    for(int i = 0; i < w->nb_buffers; i++){
+        iovecs[i].iov_base = w->buffers[i].data;
+        iovecs[i].iov_len = w->buffer_size;
+    }
+
+    ret = io_uring_register_buffers(&w->ring, iovecs, w->nb_buffers);
+    free(iovecs);
+    if(ret < 0){
+        io_uring_queue_exit(&w->ring);
+        return ret;
+    }
+
+    return 0;
+}
+#endif
+
+static int thread_init(AsyncWriter *w){
+    int ret;
+
+    w->queue = calloc(w->nb_buffers, sizeof(*w->queue));
+    if(!w->queue){
+        return -ENOMEM;
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    ret = pthread_create(&w->thread, NULL, writer_thread, w);
+    if(ret){
+        return -ret;
+    }
+    w->thread_started = 1;
+
+    return 0;
+}
+
+//hand a full buffer to the backend
+static int submit_buffer(AsyncWriter *w, AwBuffer *buffer){
+    size_t size = buffer->size;
+    int ret = 0;
+
+    if(!size){
+        return 0;
+    }
+
+    buffer->offset = w->offset;
+    w->offset += size;
+
+    //o_direct needs block sized writes, the unaligned tail goes through the page cache
+    if(w->direct && (size % AW_ALIGNMENT)){
+        if(fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT) < 0){
+            return -errno;
+        }
+        w->direct = 0;
+    }
+
+#ifdef HAVE_LIBURING
+    if(w->backend == AW_BACKEND_URING){
+        return uring_submit(w, buffer);
+    }
+#endif
+
+    pthread_mutex_lock(&w->lock);
+    buffer->in_flight = 1;
+    w->queue[(w->queue_head + w->queue_len) % w->nb_buffers] = buffer - w->buffers;
+    w->queue_len++;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return ret;
+}
+
+static AwBuffer *find_idle_buffer(AsyncWriter *w){
+    for(int i = 0; i < w->nb_buffers; i++){
+        if(!w->buffers[i].in_flight){
+            w->buffers[i].size = 0;
+            return &w->buffers[i];
+        }
+    }
+
+    return NULL;
+}
+
+//get an idle buffer for the producer, blocking only when all are in flight
+static int next_buffer(AsyncWriter *w){
+    int64_t start;
+    int ret = 0;
+
+#ifdef HAVE_LIBURING
+    if(w->backend == AW_BACKEND_URING){
+        while(!(w->current = find_idle_buffer(w))){
+            if((ret = uring_reap(w)) < 0){
+                return ret;
+            }
+        }
+        return 0;
+    }
+#endif
+
+    //time spent here is the producer stalled on the disk
+    start = ms_timer_start();
+    pthread_mutex_lock(&w->lock);
+    while(!(ret = w->thread_error) && !(w->current = find_idle_buffer(w))){
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    ms_timer_stop(MS_IO_WAIT, start);
+
+    return ret;
+}
+
+int aw_open(AsyncWriter **pw, const char *path, const AsyncWriterOptions *opts){
+    AsyncWriter *w;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int ret = 0;
+
+    w = calloc(1, sizeof(*w));
+    if(!w){
+        return -ENOMEM;
+    }
+
+    w->fd = -1;
+    w->buffer_size = (opts && opts->buffer_size) ? opts->buffer_size : AW_BUFFER_SIZE;
+    w->nb_buffers = (opts && opts->nb_buffers >= 2) ? opts->nb_buffers : AW_NB_BUFFERS;
+    w->direct = opts ? opts->direct : 0;
+    w->backend = opts ? opts->backend : AW_BACKEND_AUTO;
+
+    //keep every full buffer block aligned for o_direct
+    w->buffer_size = (w->buffer_size + AW_ALIGNMENT - 1) & ~(size_t)(AW_ALIGNMENT - 1);
+
+    w->fd = open(path, flags | (w->direct ? O_DIRECT : 0), 0644);
+    if(w->fd < 0 && w->direct && errno == EINVAL){
+        //filesystem without o_direct support, fall back to buffered io
+        w->direct = 0;
+        w->fd = open(path, flags, 0644);
+    }
+
+    if(w->fd < 0){
+        ret = -errno;
+        goto __FAIL;
+    }
+
+    w->seekable = lseek(w->fd, 0, SEEK_CUR) >= 0;
+
+    w->buffers = calloc(w->nb_buffers, sizeof(*w->buffers));
+    if(!w->buffers){
+        ret = -ENOMEM;
+        goto __FAIL;
+    }
+
+    for(int i = 0; i < w->nb_buffers; i++){
+        ret = posix_memalign((void **)&w->buffers[i].data, AW_ALIGNMENT, w->buffer_size);
+        if(ret){
+            ret = -ret;
+            goto __FAIL;
+        }
+        ms_count(MS_ALLOCS, 1);
+    }
+
+    //pipes have no offsets, only the ordered writer thread can handle them
+    if(!w->seekable){
+        w->backend = AW_BACKEND_THREAD;
+    }
+
+#ifdef HAVE_LIBURING
+    if(w->backend != AW_BACKEND_THREAD){
+        if(uring_init(w) == 0){
+            w->backend = AW_BACKEND_URING;
+        }else if(w->backend == AW_BACKEND_URING){
+            ret = -ENOSYS;
+            goto __FAIL;
+        }else{
+            w->backend = AW_BACKEND_THREAD;
+        }
+    }
+#else
+    if(w->backend == AW_BACKEND_URING){
+        ret = -ENOSYS;
+        goto __FAIL;
+    }
+    w->backend = AW_BACKEND_THREAD;
+#endif
+
+    if(w->backend == AW_BACKEND_THREAD){
+        ret = thread_init(w);
+        if(ret < 0){
+            goto __FAIL;
+        }
+    }
+
+    w->current = &w->buffers[0];
+    *pw = w;
+
+    return 0;
+
+__FAIL:
+    aw_close(&w);
+    return ret;
+}
+
+int aw_write(AsyncWriter *w, const void *data, size_t size){
+    const uint8_t *src = data;
+    int ret;
+
+    if(w->error < 0){
+        return w->error;
+    }
+
+    while(size > 0){
+        size_t len = w->buffer_size - w->current->size;
+
+        if(len > size){
+            len = size;
+        }
+
+        memcpy(w->current->data + w->current->size, src, len);
+        w->current->size += len;
+        src += len;
+        size -= len;
+
+        if(w->current->size == w->buffer_size){
+            if((ret = submit_buffer(w, w->current)) < 0 ||
+               (ret = next_buffer(w)) < 0){
+                w->error = ret;
+                return ret;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int aw_close(AsyncWriter **pw){
+    AsyncWriter *w = *pw;
+    int ret = 0;
+
+    if(!w){
+        return 0;
+    }
+
+    if(w->current && w->error == 0){
+        ret = submit_buffer(w, w->current);
+    }
+
+#ifdef HAVE_LIBURING
+    if(w->backend == AW_BACKEND_URING){
+        while(w->nb_in_flight > 0){
+            int err = uring_reap(w);
+            if(err < 0 && ret == 0){
+                ret = err;
+            }
+        }
+        io_uring_queue_exit(&w->ring);
+    }
+#endif
+
+    if(w->thread_started){
+        pthread_mutex_lock(&w->lock);
+        w->quit = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+
+    if(ret == 0){
+        ret = w->error < 0 ? w->error : w->thread_error;
+    }
+
+    if(w->fd >= 0 && close(w->fd) < 0 && ret == 0){
+        ret = -errno;
+    }
+
+    if(w->buffers){
+        for(int i = 0; i < w->nb_buffers; i++){
+            free(w->buffers[i].data);
+        }
+        free(w->buffers);
+    }
+
+    free(w->queue);
+    free(w);
+    *pw = NULL;
+
+    return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stddef.h>
+
+//double buffered file output for the extraction tools.
+//data is gathered into large aligned buffers which are written by io_uring
+//when built with -DHAVE_LIBURING -luring, otherwise by a writer thread (-lpthread).
+//needs media_stats.c for its io timers.
+//aw_write only blocks when every buffer is in flight
+
+#define AW_BUFFER_SIZE (4 << 20)
+#define AW_NB_BUFFERS 4
+#define AW_ALIGNMENT 4096
+
+enum AsyncWriterBackend {
+    AW_BACKEND_AUTO,
+    AW_BACKEND_URING,
+    AW_BACKEND_THREAD,
+};
+
+//zero fields pick the defaults above
+typedef struct AsyncWriterOptions {
+    size_t buffer_size;
+    int nb_buffers;
+    int direct;
+    enum AsyncWriterBackend backend;
+} AsyncWriterOptions;
+
+typedef struct AsyncWriter AsyncWriter;
+
+int aw_open(AsyncWriter **pw, const char *path, const AsyncWriterOptions *opts);
+int aw_write(AsyncWriter *w, const void *data, size_t size);
+//flush what is left, wait for every buffer and close the file
+int aw_close(AsyncWriter **pw);
+
+#endif
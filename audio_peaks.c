@@ -0,0 +1,665 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavutil/log.h>
+#include <libavutil/channel_layout.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "media_pipeline.h"
+#include "media_stats.h"
+
+//min/max/rms peaks of an audio track at several zoom levels in one pass.
+//input is the first audio stream of a media file decoded to s16 stereo,
+//or with -r raw pcm in pcm_player's format (s16 stereo, 44100 by default).
+//level 0 has one peak per -s frames, every next level halves the resolution.
+//each level streams to its own temp file so memory stays constant.
+//
+//binary output, little endian:
+//  "PEAK" u32 version u32 sample_rate u32 channels u32 frames_per_peak u32 nb_levels
+//  u64 nb_peaks per level, then per level per peak per channel: s16 min, s16 max, u16 rms
+
+#define PEAKS_VERSION 1
+#define PEAKS_CHANNELS 2
+#define PEAKS_MAX_LEVELS 16
+#define READ_BLOCK (1 << 20)
+
+typedef struct PeakAccumulator {
+    int16_t min[PEAKS_CHANNELS];
+    int16_t max[PEAKS_CHANNELS];
+    uint64_t sumsq[PEAKS_CHANNELS];
+    int64_t nb_frames;
+} PeakAccumulator;
+
+typedef struct PeakLevel {
+    PeakAccumulator pending;
+    //level 0 counts frames, the others count peaks of the level below
+    int nb_merged;
+    int64_t nb_peaks;
+    FILE *tmp;
+} PeakLevel;
+
+typedef struct PeakContext {
+    int frames_per_peak;
+    int nb_levels;
+    int sample_rate;
+    int json;
+    PeakLevel levels[PEAKS_MAX_LEVELS];
+} PeakContext;
+
+static void (*accumulate_s16)(PeakAccumulator *acc, const int16_t *samples, int nb_frames);
+
+static void accumulator_reset(PeakAccumulator *acc){
+    for(int c = 0; c < PEAKS_CHANNELS; c++){
+        acc->min[c] = INT16_MAX;
+        acc->max[c] = INT16_MIN;
+        acc->sumsq[c] = 0;
+    }
+    acc->nb_frames = 0;
+}
+
+static void accumulate_s16_c(PeakAccumulator *acc, const int16_t *samples, int nb_frames){
+    for(int i = 0; i < nb_frames; i++, samples += PEAKS_CHANNELS){
+        for(int c = 0; c < PEAKS_CHANNELS; c++){
+            int s = samples[c];
+
+            acc->min[c] = s < acc->min[c] ? s : acc->min[c];
+            acc->max[c] = s > acc->max[c] ? s : acc->max[c];
+            acc->sumsq[c] += s * s;
+        }
+    }
+    acc->nb_frames += nb_frames;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//interleaved l r l r lanes: min/max keep channels apart in even and odd lanes,
+//pmaddwd against a copy with the other channel zeroed gives per channel squares
+static void accumulate_s16_sse2(PeakAccumulator *acc, const int16_t *samples, int nb_frames){
+    const __m128i left_mask = _mm_set1_epi32(0x0000ffff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vmin = _mm_set1_epi16(INT16_MAX), vmax = _mm_set1_epi16(INT16_MIN);
+    __m128i sum_l = zero, sum_r = zero;
+    int16_t mins[8], maxs[8];
+    uint64_t sums[2][2];
+    int i = 0;
+
+    for(; i + 4 <= nb_frames; i += 4){
+        __m128i v = _mm_loadu_si128((const __m128i *)(samples + i * 2));
+        __m128i l = _mm_madd_epi16(v, _mm_and_si128(v, left_mask));
+        __m128i r = _mm_madd_epi16(v, _mm_andnot_si128(left_mask, v));
+
+        vmin = _mm_min_epi16(vmin, v);
+        vmax = _mm_max_epi16(vmax, v);
+
+        //squares are at most 2^30, widen before adding
+        sum_l = _mm_add_epi64(sum_l, _mm_add_epi64(_mm_unpacklo_epi32(l, zero), _mm_unpackhi_epi32(l, zero)));
+        sum_r = _mm_add_epi64(sum_r, _mm_add_epi64(_mm_unpacklo_epi32(r, zero), _mm_unpackhi_epi32(r, zero)));
+    }
+
+    _mm_storeu_si128((__m128i *)mins, vmin);
+    _mm_storeu_si128((__m128i *)maxs, vmax);
+    _mm_storeu_si128((__m128i *)sums[0], sum_l);
+    _mm_storeu_si128((__m128i *)sums[1], sum_r);
+
+    for(int k = 0; k < 8; k++){
+        int c = k & 1;
+
+        acc->min[c] = mins[k] < acc->min[c] ? mins[k] : acc->min[c];
+        acc->max[c] = maxs[k] > acc->max[c] ? maxs[k] : acc->max[c];
+    }
+    acc->sumsq[0] += sums[0][0] + sums[0][1];
+    acc->sumsq[1] += sums[1][0] + sums[1][1];
+    acc->nb_frames += i;
+
+    accumulate_s16_c(acc, samples + i * 2, nb_frames - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_s16_avx2(PeakAccumulator *acc, const int16_t *samples, int nb_frames){
+    const __m256i left_mask = _mm256_set1_epi32(0x0000ffff);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i vmin = _mm256_set1_epi16(INT16_MAX), vmax = _mm256_set1_epi16(INT16_MIN);
+    __m256i sum_l = zero, sum_r = zero;
+    int16_t mins[16], maxs[16];
+    uint64_t sums[2][4];
+    int i = 0;
+
+    for(; i + 8 <= nb_frames; i += 8){
+        __m256i v = _mm256_loadu_si256((const __m256i *)(samples + i * 2));
+        __m256i l = _mm256_madd_epi16(v, _mm256_and_si256(v, left_mask));
+        __m256i r = _mm256_madd_epi16(v, _mm256_andnot_si256(left_mask, v));
+
+        vmin = _mm256_min_epi16(vmin, v);
+        vmax = _mm256_max_epi16(vmax, v);
+
+        sum_l = _mm256_add_epi64(sum_l, _mm256_add_epi64(_mm256_unpacklo_epi32(l, zero), _mm256_unpackhi_epi32(l, zero)));
+        sum_r = _mm256_add_epi64(sum_r, _mm256_add_epi64(_mm256_unpacklo_epi32(r, zero), _mm256_unpackhi_epi32(r, zero)));
+    }
+
+    _mm256_storeu_si256((__m256i *)mins, vmin);
+    _mm256_storeu_si256((__m256i *)maxs, vmax);
+    _mm256_storeu_si256((__m256i *)sums[0], sum_l);
+    _mm256_storeu_si256((__m256i *)sums[1], sum_r);
+
+    for(int k = 0; k < 16; k++){
+        int c = k & 1;
+
+        acc->min[c] = mins[k] < acc->min[c] ? mins[k] : acc->min[c];
+        acc->max[c] = maxs[k] > acc->max[c] ? maxs[k] : acc->max[c];
+    }
+    for(int k = 0; k < 4; k++){
+        acc->sumsq[0] += sums[0][k];
+        acc->sumsq[1] += sums[1][k];
+    }
+    acc->nb_frames += i;
+
+    accumulate_s16_c(acc, samples + i * 2, nb_frames - i);
+}
+#endif
+
+static void dsp_init(void){
+    accumulate_s16 = accumulate_s16_c;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")){
+        accumulate_s16 = accumulate_s16_sse2;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        accumulate_s16 = accumulate_s16_avx2;
+    }
+#endif
+}
+
+static void merge(PeakAccumulator *dst, const PeakAccumulator *src){
+    for(int c = 0; c < PEAKS_CHANNELS; c++){
+        dst->min[c] = src->min[c] < dst->min[c] ? src->min[c] : dst->min[c];
+        dst->max[c] = src->max[c] > dst->max[c] ? src->max[c] : dst->max[c];
+        dst->sumsq[c] += src->sumsq[c];
+    }
+    dst->nb_frames += src->nb_frames;
+}
+
+static int write_peak(PeakLevel *level, const PeakAccumulator *acc){
+    uint8_t record[PEAKS_CHANNELS * 6];
+
+    for(int c = 0; c < PEAKS_CHANNELS; c++){
+        unsigned int rms = lrint(sqrt((double)acc->sumsq[c] / acc->nb_frames));
+        uint8_t *p = record + c * 6;
+
+        p[0] = acc->min[c] & 0xff;
+        p[1] = (acc->min[c] >> 8) & 0xff;
+        p[2] = acc->max[c] & 0xff;
+        p[3] = (acc->max[c] >> 8) & 0xff;
+        p[4] = rms & 0xff;
+        p[5] = (rms >> 8) & 0xff;
+    }
+
+    level->nb_peaks++;
+
+    return fwrite(record, sizeof(record), 1, level->tmp) == 1 ? 0 : AVERROR(EIO);
+}
+
+//a finished level 0 peak is written and merged upwards, every two peaks of
+//one level complete a peak of the next
+static int emit_peak(PeakContext *ctx, PeakAccumulator acc){
+    int ret;
+
+    for(int i = 0; i < ctx->nb_levels; i++){
+        PeakLevel *level = &ctx->levels[i];
+
+        if(i > 0){
+            merge(&level->pending, &acc);
+            if(++level->nb_merged < 2){
+                return 0;
+            }
+            acc = level->pending;
+            accumulator_reset(&level->pending);
+            level->nb_merged = 0;
+        }
+
+        if((ret = write_peak(level, &acc)) < 0){
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int feed(PeakContext *ctx, const int16_t *samples, int64_t nb_frames){
+    PeakLevel *base = &ctx->levels[0];
+    int64_t start = ms_timer_start();
+    int ret = 0;
+
+    ms_count(MS_BYTES_IN, nb_frames * PEAKS_CHANNELS * 2);
+
+    while(nb_frames > 0){
+        int len = ctx->frames_per_peak - base->nb_merged;
+
+        if(len > nb_frames){
+            len = nb_frames;
+        }
+
+        accumulate_s16(&base->pending, samples, len);
+        base->nb_merged += len;
+        samples += len * PEAKS_CHANNELS;
+        nb_frames -= len;
+
+        if(base->nb_merged == ctx->frames_per_peak){
+            PeakAccumulator done = base->pending;
+
+            accumulator_reset(&base->pending);
+            base->nb_merged = 0;
+            if((ret = emit_peak(ctx, done)) < 0){
+                break;
+            }
+            //a mapped file is fed in one call, report from in here
+            ms_tick();
+        }
+    }
+
+    ms_timer_stop(MS_ANALYZE, start);
+
+    return ret;
+}
+
+//partial peaks at the end of the track still count, each one also goes
+//into the partial peak of the level above
+static int flush_levels(PeakContext *ctx){
+    PeakLevel *base = &ctx->levels[0];
+    int ret;
+
+    if(base->nb_merged){
+        PeakAccumulator done = base->pending;
+
+        base->nb_merged = 0;
+        if((ret = emit_peak(ctx, done)) < 0){
+            return ret;
+        }
+    }
+
+    for(int i = 1; i < ctx->nb_levels; i++){
+        PeakLevel *level = &ctx->levels[i];
+
+        if(!level->nb_merged){
+            continue;
+        }
+
+        if((ret = write_peak(level, &level->pending)) < 0){
+            return ret;
+        }
+
+        if(i + 1 < ctx->nb_levels){
+            merge(&ctx->levels[i + 1].pending, &level->pending);
+            ctx->levels[i + 1].nb_merged++;
+        }
+        level->nb_merged = 0;
+    }
+
+    return 0;
+}
+
+static void put_le32(FILE *out, uint32_t v){
+    uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+    fwrite(b, 1, 4, out);
+}
+
+static int write_output(PeakContext *ctx, const char *path){
+    FILE *out = fopen(path, "wb");
+    uint8_t buf[4096];
+    int ret = 0;
+
+    if(!out){
+        av_log(NULL, AV_LOG_ERROR, "failed to open %s\n", path);
+        return AVERROR(errno);
+    }
+
+    if(ctx->json){
+        fprintf(out, "{\"sample_rate\":%d,\"channels\":%d,\"levels\":[", ctx->sample_rate, PEAKS_CHANNELS);
+    }else{
+        fwrite("PEAK", 1, 4, out);
+        put_le32(out, PEAKS_VERSION);
+        put_le32(out, ctx->sample_rate);
+        put_le32(out, PEAKS_CHANNELS);
+        put_le32(out, ctx->frames_per_peak);
+        put_le32(out, ctx->nb_levels);
+        for(int i = 0; i < ctx->nb_levels; i++){
+            put_le32(out, ctx->levels[i].nb_peaks);
+            put_le32(out, ctx->levels[i].nb_peaks >> 32);
+        }
+    }
+
+    for(int i = 0; i < ctx->nb_levels; i++){
+        PeakLevel *level = &ctx->levels[i];
+        size_t len;
+
+        rewind(level->tmp);
+
+        if(!ctx->json){
+            while((len = fread(buf, 1, sizeof(buf), level->tmp)) > 0){
+                fwrite(buf, 1, len, out);
+            }
+            continue;
+        }
+
+        fprintf(out, "%s{\"frames_per_peak\":%lld,\"peaks\":[", i ? "," : "",
+                (long long)ctx->frames_per_peak << i);
+        for(int64_t n = 0; n < level->nb_peaks; n++){
+            uint8_t record[PEAKS_CHANNELS * 6];
+
+            if(fread(record, sizeof(record), 1, level->tmp) != 1){
+                ret = AVERROR(EIO);
+                break;
+            }
+
+            fprintf(out, "%s[", n ? "," : "");
+            for(int c = 0; c < PEAKS_CHANNELS; c++){
+                const uint8_t *p = record + c * 6;
+
+                fprintf(out, "%s%d,%d,%d", c ? "," : "",
+                        (int16_t)(p[0] | p[1] << 8), (int16_t)(p[2] | p[3] << 8), p[4] | p[5] << 8);
+            }
+            fprintf(out, "]");
+        }
+        fprintf(out, "]}");
+    }
+
+    if(ctx->json){
+        fprintf(out, "]}\n");
+    }
+
+    if(fclose(out) && ret >= 0){
+        ret = AVERROR(errno);
+    }
+
+    return ret;
+}
+
+//raw s16 stereo straight from the page cache, no copies at all
+static int run_raw(PeakContext *ctx, const char *path){
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    int16_t *buf = NULL;
+    int ret = 0;
+
+    if(fd < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open pcm file\n");
+        return AVERROR(errno);
+    }
+
+    if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0){
+        const size_t frame_size = PEAKS_CHANNELS * sizeof(int16_t);
+        uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(map != MAP_FAILED){
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            ret = feed(ctx, (const int16_t *)map, st.st_size / frame_size);
+            munmap(map, st.st_size);
+            close(fd);
+            return ret;
+        }
+    }
+
+    //pipes and the like are read in large blocks instead
+    buf = malloc(READ_BLOCK);
+    if(!buf){
+        close(fd);
+        return AVERROR(ENOMEM);
+    }
+
+    while(1){
+        size_t have = 0;
+        ssize_t len;
+        int64_t start = ms_timer_start();
+
+        while(have < READ_BLOCK && (len = read(fd, (uint8_t *)buf + have, READ_BLOCK - have)) > 0){
+            have += len;
+        }
+        ms_timer_stop(MS_IO, start);
+
+        if(!have){
+            break;
+        }
+
+        if((ret = feed(ctx, buf, have / (PEAKS_CHANNELS * sizeof(int16_t)))) < 0){
+            break;
+        }
+    }
+
+    free(buf);
+    close(fd);
+
+    return ret;
+}
+
+typedef struct DecodeSink {
+    PeakContext *ctx;
+    int audio_index;
+    AVCodecContext *pCodecContext;
+    struct SwrContext *pSwrContext;
+    AVFrame *pFrame;
+    //s16 stereo conversion buffer, grown to the largest frame once
+    uint8_t *buf;
+    int buf_frames;
+} DecodeSink;
+
+static int decode_sink_open(void *opaque, MediaInput *input){
+    DecodeSink *sink = opaque;
+    AVCodecParameters *pCodecParameters = input->pFormatContext->streams[sink->audio_index]->codecpar;
+    const AVCodec *pCodec = avcodec_find_decoder(pCodecParameters->codec_id);
+    int ret;
+
+    if(!pCodec){
+        av_log(NULL, AV_LOG_ERROR, "no decoder for %s\n", avcodec_get_name(pCodecParameters->codec_id));
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    sink->pCodecContext = avcodec_alloc_context3(pCodec);
+    sink->pFrame = av_frame_alloc();
+    if(!sink->pCodecContext || !sink->pFrame){
+        return AVERROR(ENOMEM);
+    }
+
+    if((ret = avcodec_parameters_to_context(sink->pCodecContext, pCodecParameters)) < 0 ||
+       (ret = avcodec_open2(sink->pCodecContext, pCodec, NULL)) < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open decoder\n");
+        return ret;
+    }
+
+    sink->ctx->sample_rate = sink->pCodecContext->sample_rate;
+
+    return 0;
+}
+
+//decoded audio of any layout becomes s16 stereo at the source rate
+static int convert_frame(DecodeSink *sink, AVFrame *pFrame){
+    int ret;
+
+    if(!sink->pSwrContext){
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
+        AVChannelLayout stereo;
+
+        av_channel_layout_default(&stereo, PEAKS_CHANNELS);
+        ret = swr_alloc_set_opts2(&sink->pSwrContext,
+                                  &stereo, AV_SAMPLE_FMT_S16, pFrame->sample_rate,
+                                  &pFrame->ch_layout, pFrame->format, pFrame->sample_rate,
+                                  0, NULL);
+        if(ret < 0){
+            return ret;
+        }
+#else
+        sink->pSwrContext = swr_alloc_set_opts(NULL,
+                                               AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, pFrame->sample_rate,
+                                               pFrame->channel_layout ? pFrame->channel_layout
+                                                                      : av_get_default_channel_layout(pFrame->channels),
+                                               pFrame->format, pFrame->sample_rate,
+                                               0, NULL);
+        if(!sink->pSwrContext){
+            return AVERROR(ENOMEM);
+        }
+#endif
+        if((ret = swr_init(sink->pSwrContext)) < 0){
+            return ret;
+        }
+    }
+
+    if(pFrame->nb_samples > sink->buf_frames){
+        ret = av_reallocp(&sink->buf, pFrame->nb_samples * PEAKS_CHANNELS * sizeof(int16_t));
+        if(ret < 0){
+            return ret;
+        }
+        sink->buf_frames = pFrame->nb_samples;
+        ms_count(MS_ALLOCS, 1);
+    }
+
+    ret = swr_convert(sink->pSwrContext, &sink->buf, sink->buf_frames,
+                      (const uint8_t **)pFrame->extended_data, pFrame->nb_samples);
+    if(ret < 0){
+        return ret;
+    }
+
+    return feed(sink->ctx, (const int16_t *)sink->buf, ret);
+}
+
+static int decode_packet(DecodeSink *sink, AVPacket *pPacket){
+    int64_t start = ms_timer_start();
+    int ret;
+
+    ret = avcodec_send_packet(sink->pCodecContext, pPacket);
+    if(ret < 0 && ret != AVERROR_EOF){
+        av_log(NULL, AV_LOG_WARNING, "skipping undecodable packet\n");
+        return 0;
+    }
+
+    while((ret = avcodec_receive_frame(sink->pCodecContext, sink->pFrame)) >= 0){
+        ms_timer_stop(MS_DECODE, start);
+        ms_count(MS_FRAMES, 1);
+
+        ret = convert_frame(sink, sink->pFrame);
+        av_frame_unref(sink->pFrame);
+        if(ret < 0){
+            return ret;
+        }
+        start = ms_timer_start();
+    }
+
+    return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+static int decode_sink_write(void *opaque, MediaInput *input, AVPacket *pPacket){
+    return decode_packet(opaque, pPacket);
+}
+
+static int decode_sink_close(void *opaque, MediaInput *input){
+    DecodeSink *sink = opaque;
+    int ret = 0;
+
+    //drain the decoder so the tail of the track is not lost
+    if(sink->pCodecContext && sink->pFrame){
+        ret = decode_packet(sink, NULL);
+    }
+
+    av_freep(&sink->buf);
+    swr_free(&sink->pSwrContext);
+    av_frame_free(&sink->pFrame);
+    avcodec_free_context(&sink->pCodecContext);
+
+    return ret;
+}
+
+int main(int argc, char *argv[]){
+    int ret = 0, opt, raw = 0;
+
+    MediaInput input = { 0 };
+    PeakContext ctx = {
+        .frames_per_peak = 256,
+        .nb_levels = 8,
+        .sample_rate = 44100,
+    };
+    DecodeSink decode_sink = { .ctx = &ctx };
+    MediaSink sink = {
+        .opaque = &decode_sink,
+        .open = decode_sink_open,
+        .write_packet = decode_sink_write,
+        .close = decode_sink_close,
+    };
+
+    av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
+
+    //-r raw pcm input, -a its sample rate, -s frames per level 0 peak, -l levels, -J json output
+    while((opt = getopt(argc, argv, "ra:s:l:J")) != -1){
+        switch(opt){
+        case 'r': raw = 1; break;
+        case 'a': ctx.sample_rate = atoi(optarg); break;
+        case 's': ctx.frames_per_peak = atoi(optarg); break;
+        case 'l': ctx.nb_levels = atoi(optarg); break;
+        case 'J': ctx.json = 1; break;
+        default: return -1;
+        }
+    }
+
+    if(argc - optind < 2 || ctx.frames_per_peak <= 0 ||
+       ctx.nb_levels < 1 || ctx.nb_levels > PEAKS_MAX_LEVELS){
+        av_log(NULL, AV_LOG_ERROR,
+        "Please input source media (or -r pcm) file url and output peaks file url\n");
+        return -1;
+    }
+
+    dsp_init();
+
+    for(int i = 0; i < ctx.nb_levels; i++){
+        accumulator_reset(&ctx.levels[i].pending);
+        ctx.levels[i].tmp = tmpfile();
+        if(!ctx.levels[i].tmp){
+            av_log(NULL, AV_LOG_ERROR, "failed to create temp file\n");
+            ret = AVERROR(errno);
+            goto __FAIL;
+        }
+    }
+
+    if(raw){
+        ret = run_raw(&ctx, argv[optind]);
+    }else{
+        ret = mp_open_input(&input, argv[optind], NULL);
+        if(ret < 0){
+            goto __FAIL;
+        }
+
+        decode_sink.audio_index = mp_find_stream(&input, AVMEDIA_TYPE_AUDIO);
+        if(decode_sink.audio_index < 0){
+            av_log(NULL, AV_LOG_ERROR, "no audio stream found from input media file!\n");
+            ret = decode_sink.audio_index;
+        }else{
+            ret = mp_run(&input, decode_sink.audio_index, &sink);
+        }
+
+        mp_close_input(&input);
+    }
+
+    if(ret >= 0 && (ret = flush_levels(&ctx)) >= 0){
+        ret = write_output(&ctx, argv[optind + 1]);
+        av_log(NULL, AV_LOG_INFO, "%"PRId64" peaks at level 0, %d levels\n", ctx.levels[0].nb_peaks, ctx.nb_levels);
+    }
+
+__FAIL:
+    for(int i = 0; i < ctx.nb_levels; i++){
+        if(ctx.levels[i].tmp){
+            fclose(ctx.levels[i].tmp);
+        }
+    }
+
+    return ret < 0 ? -1 : 0;
+}
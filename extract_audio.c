@@ -1,147 +1,132 @@
-#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <libavutil/log.h>
 #include <libavformat/avformat.h>
 
-void adts_header(char *szAdtsHeader, int dataLen){
-    int audio_object_type = 2;
-    int sampling_frequency_index = 4;
-    int channel_config = 2;
-
-    int adtsLen = dataLen + 7;
-
-    szAdtsHeader[0] = 0xff;
-    szAdtsHeader[1] = 0xf0;
-    szAdtsHeader[1] |= (0 << 3);
-    szAdtsHeader[1] |= (0 << 1);
-    szAdtsHeader[1] |= 1;
-
-    szAdtsHeader[2] = (audio_object_type - 1) << 6;
-    szAdtsHeader[2] |= (sampling_frequency_index & 0x0f)<<2;
-    szAdtsHeader[2] |= (0<<1);
-    szAdtsHeader[2] |= (channel_config & 0x04)>>2;
-
-    szAdtsHeader[3] = (channel_config & 0x03)<<6;
-    szAdtsHeader[3] |= (0 << 5);
-    szAdtsHeader[3] |= (0 << 4);
-    szAdtsHeader[3] |= (0 << 3);
-    szAdtsHeader[3] |= (0 << 2);
-    szAdtsHeader[3] |= ((adtsLen & 0x1800) >> 11);
-
-    szAdtsHeader[4] =(uint8_t)((adtsLen & 0x7f8) >> 3);
-    szAdtsHeader[5] =(uint8_t)((adtsLen & 0x7) << 5);
-    szAdtsHeader[5] |= 0x1f;
-    szAdtsHeader[6] = 0xfc;
-}
+#include "async_writer.h"
+#include "media_pipeline.h"
+#include "media_stats.h"
 
-int main(int argc, char *argv[]){
-    int ret = 0;
-    char *src = NULL;
-    char *dst = NULL;
+typedef struct AdtsSink {
+    AsyncWriter *writer;
+    int audio_index;
+    AVCodecParameters *pCodecParameters;
+} AdtsSink;
 
-    AVPacket *pPacket = NULL; 
-    AVCodecParameters *pCodecParameters = NULL;
-    int audio_index = 0;
-    int len = 0;
-    bool audio_stream_found = false;
+static int adts_sink_open(void *opaque, MediaInput *input){
+    AdtsSink *sink = opaque;
 
-    if(argc < 3){
-        av_log(NULL, AV_LOG_ERROR, 
-        "Please input source media file url and output audio file url");
-        return -1;
+    sink->pCodecParameters = input->pFormatContext->streams[sink->audio_index]->codecpar;
+
+    //adts only frames aac
+    if(sink->pCodecParameters->codec_id != AV_CODEC_ID_AAC){
+        av_log(NULL, AV_LOG_ERROR, "only aac can be extracted, the audio is %s\n",
+               avcodec_get_name(sink->pCodecParameters->codec_id));
+        return AVERROR_PATCHWELCOME;
     }
 
-    AVFormatContext *pFormatContext = NULL;
-    
-    av_log_set_level(AV_LOG_INFO);
+    return 0;
+}
 
-    // av_register_all();
+//add adts header for aac
+static int adts_sink_write(void *opaque, MediaInput *input, AVPacket *pPacket){
+    AdtsSink *sink = opaque;
+    uint8_t adts_header_buf[7];
+    int64_t start;
+    int ret;
+
+    //ts input carries adts framing already
+    if(pPacket->size >= 7 && pPacket->data[0] == 0xff && (pPacket->data[1] & 0xf6) == 0xf0){
+        ret = aw_write(sink->writer, pPacket->data, pPacket->size);
+        if(ret < 0){
+            av_log(NULL, AV_LOG_ERROR, "failed to write audio data: %s\n", av_err2str(ret));
+        }
+        return ret;
+    }
 
-    src = argv[1];
-    dst = argv[2];
+    start = ms_timer_start();
+    mp_adts_header(adts_header_buf, sink->pCodecParameters, pPacket->size);
+    ms_timer_stop(MS_REWRITE, start);
 
-    if(!src || !dst){
-        av_log(NULL, AV_LOG_ERROR, "src or dst is NULL");
-        return -1;
+    //both land in the same output buffer, no syscall per frame
+    if((ret = aw_write(sink->writer, adts_header_buf, 7)) < 0 ||
+       (ret = aw_write(sink->writer, pPacket->data, pPacket->size)) < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to write audio data: %s\n", av_err2str(ret));
+        return ret;
     }
 
-    ret = avformat_open_input(&pFormatContext, src, NULL, NULL);
+    return 0;
+}
 
-    if(ret < 0){
-        av_log(NULL, AV_LOG_ERROR, "avformat open failed %s\n", av_err2str(ret));
-        return -1;
+int main(int argc, char *argv[]){
+    int ret = 0, opt;
+    char *src = NULL;
+    char *dst = NULL;
+
+    AsyncWriterOptions writer_options = { 0 };
+
+    MediaInput input = { 0 };
+    AdtsSink adts_sink = { 0 };
+    MediaSink sink = {
+        .opaque = &adts_sink,
+        .open = adts_sink_open,
+        .write_packet = adts_sink_write,
+    };
+
+    //-d writes with O_DIRECT, -t forces the writer thread over io_uring
+    while((opt = getopt(argc, argv, "dt")) != -1){
+        if(opt == 'd'){
+            writer_options.direct = 1;
+        }else if(opt == 't'){
+            writer_options.backend = AW_BACKEND_THREAD;
+        }else{
+            return -1;
+        }
     }
 
-    FILE *dst_fd = fopen(dst, "wb");
-    if(!dst_fd){
-        av_log(NULL, AV_LOG_ERROR, "failed to open dst file\n");
-        goto __FAIL;
+    if(argc - optind < 2){
+        av_log(NULL, AV_LOG_ERROR, 
+        "Please input source media file url and output audio file url\n");
+        return -1;
     }
 
-    av_dump_format(pFormatContext, 1, argv[1], 0);
+    av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
+
+    src = argv[optind];
+    dst = argv[optind + 1];
 
-    if (avformat_find_stream_info(pFormatContext,  NULL) < 0) {
-        av_log(NULL, AV_LOG_ERROR, "failed to find any stream");
+    ret = mp_open_input(&input, src, NULL);
+    if(ret < 0){
         return -1;
     }
 
-    for(int i = 0; i<pFormatContext->nb_streams; i++){
-        pCodecParameters = pFormatContext->streams[i]->codecpar;
-        if(pCodecParameters->codec_type == AVMEDIA_TYPE_AUDIO){
-            //if first audio stream found, break and use it
-            audio_index = i;
-            audio_stream_found = true;
-            break;
-        }
+    adts_sink.audio_index = mp_find_stream(&input, AVMEDIA_TYPE_AUDIO);
+    if(adts_sink.audio_index < 0){
+        av_log(NULL, AV_LOG_ERROR, "no audio stream found from input media file!\n");
+        ret = adts_sink.audio_index;
+        goto __FAIL;
     }
 
-    av_log(NULL, AV_LOG_INFO, "audio index is %d\n", audio_index);
+    av_log(NULL, AV_LOG_INFO, "audio index is %d\n", adts_sink.audio_index);
 
-    if(!audio_stream_found){
-        av_log(NULL, AV_LOG_ERROR, "no audio stream found from input media file!");
+    ret = aw_open(&adts_sink.writer, dst, &writer_options);
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open dst file: %s\n", av_err2str(ret));
         goto __FAIL;
     }
 
-    // //get stream
-    // ret = av_find_best_stream(pFormatContext, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0 );
-    // if(ret < 0){
-    //     av_log(NULL, AV_LOG_ERROR, "cannot find best audio stream\n");
-    //     goto __FAIL;
-    // }
-    // audio_index = ret;
-
-    pPacket = av_packet_alloc();
-    av_init_packet(pPacket);
-
-    // av_log(NULL, AV_LOG_INFO, "before read frame");
-
-    while(av_read_frame(pFormatContext,pPacket) >= 0){
-        // av_log(NULL, AV_LOG_INFO, "stream index is %d\n", pPacket->stream_index);
-        if(pPacket->stream_index == audio_index){
-            //add adts header for aac
-            char adts_header_buf[7];
-            adts_header(adts_header_buf, pPacket->size);
-            fwrite(adts_header_buf, 1, 7, dst_fd);
-
-            len = fwrite(pPacket->data, 1, pPacket->size, dst_fd);
-            // av_log(NULL, AV_LOG_INFO, "pPacket length is %d", len);
-            if(len != pPacket->size){
-                av_log(NULL, AV_LOG_WARNING, "len not equal to packet size");
-            }
-        }
-
-        av_packet_unref(pPacket);
-    }
+    ret = mp_run(&input, adts_sink.audio_index, &sink);
 
 __FAIL:
-    if(pFormatContext){
-        avformat_close_input(&pFormatContext);
-    }
+    mp_close_input(&input);
 
-    if(dst_fd){
-        fclose(dst_fd);
+    if(adts_sink.writer){
+        int err = aw_close(&adts_sink.writer);
+        if(ret >= 0){
+            ret = err;
+        }
     }
 
-    if(pPacket){
-        av_packet_free(&pPacket);
-    }
-}
\ No newline at end of file
+    return ret < 0 ? -1 : 0;
+}
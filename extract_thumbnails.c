@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/log.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+
+#include "media_pipeline.h"
+#include "media_stats.h"
+
+//contact sheet or thumbnails from keyframes only, nothing else gets decoded.
+//the output is png when the name ends in .png and binary ppm otherwise,
+//a name with %d writes one image per thumbnail instead of a sheet
+
+typedef struct ThumbnailSink {
+    const char *dst;
+    int video_stream_index;
+    int nb_thumbnails;
+    int columns;
+    int tile_width;
+    int tile_height;
+    int single;
+
+    int nb_done;
+    AVCodecContext *pCodecContext;
+    struct SwsContext *pSwsContext;
+    AVFrame *pFrame;
+
+    //rgb24 sheet all tiles are scaled into
+    uint8_t *sheet;
+    int sheet_width;
+    int sheet_height;
+    int sheet_linesize;
+} ThumbnailSink;
+
+static int write_ppm(const char *path, const uint8_t *data, int linesize, int width, int height){
+    FILE *fd = fopen(path, "wb");
+
+    if(!fd){
+        av_log(NULL, AV_LOG_ERROR, "failed to open %s\n", path);
+        return AVERROR(errno);
+    }
+
+    fprintf(fd, "P6\n%d %d\n255\n", width, height);
+    for(int y = 0; y < height; y++){
+        if(fwrite(data + y * linesize, 1, width * 3, fd) != width * 3){
+            av_log(NULL, AV_LOG_ERROR, "failed to write %s\n", path);
+            fclose(fd);
+            return AVERROR(EIO);
+        }
+    }
+
+    return fclose(fd) ? AVERROR(errno) : 0;
+}
+
+static int write_png(const char *path, uint8_t *data, int linesize, int width, int height){
+    const AVCodec *pCodec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+    AVCodecContext *pCodecContext = NULL;
+    AVFrame *pFrame = NULL;
+    AVPacket *pPacket = NULL;
+    FILE *fd = NULL;
+    int ret;
+
+    if(!pCodec){
+        av_log(NULL, AV_LOG_ERROR, "png encoder not available\n");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    pCodecContext = avcodec_alloc_context3(pCodec);
+    pFrame = av_frame_alloc();
+    pPacket = av_packet_alloc();
+    if(!pCodecContext || !pFrame || !pPacket){
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    pCodecContext->width = width;
+    pCodecContext->height = height;
+    pCodecContext->pix_fmt = AV_PIX_FMT_RGB24;
+    pCodecContext->time_base = (AVRational){1, 25};
+
+    ret = avcodec_open2(pCodecContext, pCodec, NULL);
+    if(ret < 0){
+        goto end;
+    }
+
+    //the sheet is not refcounted, so avcodec_send_frame copies it once
+    pFrame->data[0] = data;
+    pFrame->linesize[0] = linesize;
+    pFrame->width = width;
+    pFrame->height = height;
+    pFrame->format = AV_PIX_FMT_RGB24;
+
+    if((ret = avcodec_send_frame(pCodecContext, pFrame)) < 0 ||
+       (ret = avcodec_receive_packet(pCodecContext, pPacket)) < 0){
+        goto end;
+    }
+
+    fd = fopen(path, "wb");
+    if(!fd){
+        av_log(NULL, AV_LOG_ERROR, "failed to open %s\n", path);
+        ret = AVERROR(errno);
+        goto end;
+    }
+
+    if(fwrite(pPacket->data, 1, pPacket->size, fd) != pPacket->size){
+        ret = AVERROR(EIO);
+    }
+
+end:
+    if(fd){
+        fclose(fd);
+    }
+    av_packet_free(&pPacket);
+    av_frame_free(&pFrame);
+    avcodec_free_context(&pCodecContext);
+
+    return ret;
+}
+
+static int write_image(const char *path, uint8_t *data, int linesize, int width, int height){
+    size_t len = strlen(path);
+
+    if(len > 4 && !strcmp(path + len - 4, ".png")){
+        return write_png(path, data, linesize, width, height);
+    }
+
+    return write_ppm(path, data, linesize, width, height);
+}
+
+static int thumbnail_sink_open(void *opaque, MediaInput *input){
+    ThumbnailSink *sink = opaque;
+    AVCodecParameters *pCodecParameters = input->pFormatContext->streams[sink->video_stream_index]->codecpar;
+    const AVCodec *pCodec = avcodec_find_decoder(pCodecParameters->codec_id);
+    int rows, ret;
+
+    if(!pCodec){
+        av_log(NULL, AV_LOG_ERROR, "no decoder for %s\n", avcodec_get_name(pCodecParameters->codec_id));
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    sink->pCodecContext = avcodec_alloc_context3(pCodec);
+    sink->pFrame = av_frame_alloc();
+    if(!sink->pCodecContext || !sink->pFrame){
+        return AVERROR(ENOMEM);
+    }
+
+    ret = avcodec_parameters_to_context(sink->pCodecContext, pCodecParameters);
+    if(ret < 0){
+        return ret;
+    }
+
+    //every packet fed is a keyframe, tell the decoder to drop anything else
+    sink->pCodecContext->skip_frame = AVDISCARD_NONKEY;
+
+    ret = avcodec_open2(sink->pCodecContext, pCodec, NULL);
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open decoder\n");
+        return ret;
+    }
+
+    if(pCodecParameters->width <= 0 || pCodecParameters->height <= 0){
+        av_log(NULL, AV_LOG_ERROR, "unknown video size\n");
+        return AVERROR_INVALIDDATA;
+    }
+
+    sink->tile_height = (sink->tile_width * pCodecParameters->height / pCodecParameters->width + 1) & ~1;
+
+    if(sink->single){
+        sink->sheet_width = sink->tile_width;
+        sink->sheet_height = sink->tile_height;
+    }else{
+        rows = (sink->nb_thumbnails + sink->columns - 1) / sink->columns;
+        sink->sheet_width = sink->tile_width * sink->columns;
+        sink->sheet_height = sink->tile_height * rows;
+    }
+
+    //the whole sheet is allocated once, tiles are scaled into place
+    sink->sheet_linesize = sink->sheet_width * 3;
+    sink->sheet = av_mallocz((size_t)sink->sheet_linesize * sink->sheet_height);
+    if(!sink->sheet){
+        return AVERROR(ENOMEM);
+    }
+
+    return 0;
+}
+
+static int place_tile(ThumbnailSink *sink, AVFrame *pFrame){
+    uint8_t *dst[4] = { NULL };
+    int dst_linesize[4] = { sink->sheet_linesize };
+    int index = sink->single ? 0 : sink->nb_done;
+    int64_t start;
+
+    sink->pSwsContext = sws_getCachedContext(sink->pSwsContext,
+                                             pFrame->width, pFrame->height, pFrame->format,
+                                             sink->tile_width, sink->tile_height, AV_PIX_FMT_RGB24,
+                                             SWS_AREA, NULL, NULL, NULL);
+    if(!sink->pSwsContext){
+        return AVERROR(EINVAL);
+    }
+
+    dst[0] = sink->sheet + (index / sink->columns) * sink->tile_height * sink->sheet_linesize
+                         + (index % sink->columns) * sink->tile_width * 3;
+
+    start = ms_timer_start();
+    sws_scale(sink->pSwsContext, (const uint8_t * const *)pFrame->data, pFrame->linesize,
+              0, pFrame->height, dst, dst_linesize);
+    ms_timer_stop(MS_SCALE, start);
+
+    sink->nb_done++;
+    ms_count(MS_FRAMES, 1);
+
+    if(sink->single){
+        char path[1024];
+        int ret;
+
+        if((ret = mp_format_name(path, sizeof(path), sink->dst, sink->nb_done)) < 0){
+            return ret;
+        }
+        return write_image(path, sink->sheet, sink->sheet_linesize, sink->sheet_width, sink->sheet_height);
+    }
+
+    return 0;
+}
+
+//decode one keyframe on its own, draining so the picture comes out right away
+static int thumbnail_sink_write(void *opaque, MediaInput *input, AVPacket *pPacket){
+    ThumbnailSink *sink = opaque;
+    int64_t start;
+    int ret;
+
+    if(sink->nb_done >= sink->nb_thumbnails){
+        return AVERROR_EOF;
+    }
+
+    if(!(pPacket->flags & AV_PKT_FLAG_KEY)){
+        return 0;
+    }
+
+    start = ms_timer_start();
+    ret = avcodec_send_packet(sink->pCodecContext, pPacket);
+    if(ret >= 0){
+        ret = avcodec_send_packet(sink->pCodecContext, NULL);
+    }
+
+    while(ret >= 0){
+        ret = avcodec_receive_frame(sink->pCodecContext, sink->pFrame);
+        if(ret < 0){
+            break;
+        }
+        ms_timer_stop(MS_DECODE, start);
+
+        if(sink->nb_done < sink->nb_thumbnails){
+            ret = place_tile(sink, sink->pFrame);
+        }
+        av_frame_unref(sink->pFrame);
+        start = ms_timer_start();
+    }
+
+    avcodec_flush_buffers(sink->pCodecContext);
+
+    if(ret == AVERROR_EOF || ret == AVERROR(EAGAIN) || ret == AVERROR_INVALIDDATA){
+        ret = 0;
+    }
+
+    return ret;
+}
+
+static int thumbnail_sink_close(void *opaque, MediaInput *input){
+    ThumbnailSink *sink = opaque;
+    int ret = 0;
+
+    if(!sink->single && sink->nb_done > 0){
+        ret = write_image(sink->dst, sink->sheet, sink->sheet_linesize, sink->sheet_width, sink->sheet_height);
+    }
+
+    av_log(NULL, AV_LOG_INFO, "%d thumbnails written\n", sink->nb_done);
+
+    av_freep(&sink->sheet);
+    sws_freeContext(sink->pSwsContext);
+    av_frame_free(&sink->pFrame);
+    avcodec_free_context(&sink->pCodecContext);
+
+    return ret;
+}
+
+static int64_t packet_time(const AVPacket *pPacket){
+    return pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+}
+
+//read on to the next keyframe of the stream
+static int read_keyframe(AVFormatContext *pFormatContext, int stream_index, AVPacket *pPacket){
+    int ret;
+
+    while((ret = av_read_frame(pFormatContext, pPacket)) >= 0){
+        if(pPacket->stream_index == stream_index && (pPacket->flags & AV_PKT_FLAG_KEY)){
+            break;
+        }
+        av_packet_unref(pPacket);
+    }
+
+    return ret;
+}
+
+//jump keyframe to keyframe every interval seconds instead of reading the whole stream
+static int run_seeking(MediaInput *input, ThumbnailSink *sink, const MediaSink *media_sink, double interval){
+    AVFormatContext *pFormatContext = input->pFormatContext;
+    AVStream *stream = pFormatContext->streams[sink->video_stream_index];
+    AVPacket *pPacket = mp_packet_pool_get(&input->pool);
+    int64_t start_time = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t step = av_rescale_q((int64_t)(interval * AV_TIME_BASE), AV_TIME_BASE_Q, stream->time_base);
+    int64_t duration = stream->duration;
+    int64_t last_pts = AV_NOPTS_VALUE;
+    int ret, err;
+
+    //an interval below one tick of a coarse time base would seek to the same target forever
+    step = FFMAX(step, 1);
+
+    if(duration == AV_NOPTS_VALUE && pFormatContext->duration != AV_NOPTS_VALUE){
+        duration = av_rescale_q(pFormatContext->duration, AV_TIME_BASE_Q, stream->time_base);
+    }
+
+    for(int i = 0; i < pFormatContext->nb_streams; i++){
+        pFormatContext->streams[i]->discard = i == sink->video_stream_index ? AVDISCARD_NONKEY : AVDISCARD_ALL;
+    }
+
+    if((ret = media_sink->open(sink, input)) < 0 || !pPacket){
+        ret = ret < 0 ? ret : AVERROR(ENOMEM);
+        goto end;
+    }
+
+    for(int64_t i = 0; sink->nb_done < sink->nb_thumbnails; i++){
+        int64_t target = start_time + i * step;
+        int64_t pts;
+
+        if(duration != AV_NOPTS_VALUE && target >= start_time + duration){
+            break;
+        }
+
+        ret = av_seek_frame(pFormatContext, sink->video_stream_index, target, AVSEEK_FLAG_BACKWARD);
+        if(ret < 0){
+            break;
+        }
+
+        //a sparse gop lands the target back on a keyframe already used,
+        //take the next one instead, running out of them is the end
+        while((ret = read_keyframe(pFormatContext, sink->video_stream_index, pPacket)) >= 0 &&
+              last_pts != AV_NOPTS_VALUE && packet_time(pPacket) != AV_NOPTS_VALUE &&
+              packet_time(pPacket) <= last_pts){
+            av_packet_unref(pPacket);
+        }
+
+        if(ret < 0){
+            break;
+        }
+
+        ms_count(MS_PACKETS, 1);
+        ms_count(MS_BYTES_IN, pPacket->size);
+
+        pts = packet_time(pPacket);
+        if(pts != AV_NOPTS_VALUE){
+            last_pts = pts;
+            //skip the targets that keyframe already stands for
+            if(pts > target){
+                i = (pts - start_time) / step;
+            }
+        }
+
+        ret = media_sink->write_packet(sink, input, pPacket);
+        av_packet_unref(pPacket);
+        ms_tick();
+
+        if(ret < 0){
+            break;
+        }
+    }
+
+    if(ret == AVERROR_EOF){
+        ret = 0;
+    }
+
+end:
+    mp_packet_pool_put(&input->pool, pPacket);
+
+    err = media_sink->close(sink, input);
+
+    return ret < 0 ? ret : err;
+}
+
+int main(int argc, char *argv[]){
+    char path[1024];
+    int ret = 0, opt;
+    double interval = 0;
+
+    MediaInput input = { 0 };
+    ThumbnailSink thumbnail_sink = {
+        .nb_thumbnails = 16,
+        .columns = 4,
+        .tile_width = 320,
+    };
+    MediaSink sink = {
+        .opaque = &thumbnail_sink,
+        .open = thumbnail_sink_open,
+        .write_packet = thumbnail_sink_write,
+        .close = thumbnail_sink_close,
+    };
+
+    av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
+
+    //-n thumbnails, -c sheet columns, -w tile width, -i seek interval in seconds,
+    //by default the duration split into -n parts
+    while((opt = getopt(argc, argv, "n:c:w:i:")) != -1){
+        switch(opt){
+        case 'n': thumbnail_sink.nb_thumbnails = atoi(optarg); break;
+        case 'c': thumbnail_sink.columns = atoi(optarg); break;
+        case 'w': thumbnail_sink.tile_width = atoi(optarg) & ~1; break;
+        case 'i': interval = atof(optarg); break;
+        default: return -1;
+        }
+    }
+
+    if(argc - optind < 2 || thumbnail_sink.nb_thumbnails <= 0 ||
+       thumbnail_sink.columns <= 0 || thumbnail_sink.tile_width <= 0){
+        av_log(NULL, AV_LOG_ERROR,
+        "Please input source media file url and output image url\n");
+        return -1;
+    }
+
+    thumbnail_sink.dst = argv[optind + 1];
+    //a %d in the name writes one numbered image per thumbnail instead of a sheet
+    ret = mp_format_name(path, sizeof(path), thumbnail_sink.dst, 0);
+    if(ret < 0){
+        return -1;
+    }
+    thumbnail_sink.single = ret;
+    if(thumbnail_sink.single){
+        thumbnail_sink.columns = 1;
+    }
+
+    ret = mp_open_input(&input, argv[optind], NULL);
+    if(ret < 0){
+        return -1;
+    }
+
+    thumbnail_sink.video_stream_index = mp_find_stream(&input, AVMEDIA_TYPE_VIDEO);
+    if(thumbnail_sink.video_stream_index < 0){
+        av_log(NULL, AV_LOG_ERROR, "no video stream found from input media file!\n");
+        ret = thumbnail_sink.video_stream_index;
+        goto __FAIL;
+    }
+
+    //spread the thumbnails over the whole stream rather than taking the first keyframes
+    if(interval <= 0){
+        AVStream *stream = input.pFormatContext->streams[thumbnail_sink.video_stream_index];
+
+        if(stream->duration != AV_NOPTS_VALUE && stream->duration > 0){
+            interval = stream->duration * av_q2d(stream->time_base) / thumbnail_sink.nb_thumbnails;
+        }else if(input.pFormatContext->duration != AV_NOPTS_VALUE && input.pFormatContext->duration > 0){
+            interval = (double)input.pFormatContext->duration / AV_TIME_BASE / thumbnail_sink.nb_thumbnails;
+        }
+    }
+
+    if(interval > 0){
+        ret = run_seeking(&input, &thumbnail_sink, &sink, interval);
+    }else{
+        //unknown duration, take the first keyframes.
+        //demuxers that honour it never even read the non key packets
+        input.pFormatContext->streams[thumbnail_sink.video_stream_index]->discard = AVDISCARD_NONKEY;
+        ret = mp_run(&input, thumbnail_sink.video_stream_index, &sink);
+    }
+
+__FAIL:
+    mp_close_input(&input);
+
+    return ret < 0 ? -1 : 0;
+}
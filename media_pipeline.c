@@ -0,0 +1,525 @@
+#include <string.h>
+#include <libavutil/log.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+
+#include "media_pipeline.h"
+#include "media_stats.h"
+
+static const int adts_sample_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000,
+    24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+int mp_open_input(MediaInput *input, const char *url, const MediaProbePolicy *policy){
+    int ret = 0;
+    int64_t start;
+    AVDictionary *options = NULL;
+
+    memset(input, 0, sizeof(*input));
+    input->url = url;
+
+    if(policy && policy->probesize > 0){
+        av_dict_set_int(&options, "probesize", policy->probesize, 0);
+    }
+
+    if(policy && policy->analyzeduration > 0){
+        av_dict_set_int(&options, "analyzeduration", policy->analyzeduration, 0);
+    }
+
+    //a preset pb makes avformat_open_input treat it as custom io and leave it alone on close
+    if(policy && policy->pb){
+        input->pFormatContext = avformat_alloc_context();
+        if(!input->pFormatContext){
+            av_dict_free(&options);
+            return AVERROR(ENOMEM);
+        }
+        input->pFormatContext->pb = policy->pb;
+    }
+
+    start = ms_timer_start();
+    ret = avformat_open_input(&input->pFormatContext, url, NULL, &options);
+    ms_timer_stop(MS_OPEN_INPUT, start);
+    av_dict_free(&options);
+
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "avformat open failed %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    if(!policy || !policy->skip_stream_info){
+        start = ms_timer_start();
+        ret = avformat_find_stream_info(input->pFormatContext, NULL);
+        ms_timer_stop(MS_FIND_STREAM_INFO, start);
+        if(ret < 0){
+            av_log(NULL, AV_LOG_ERROR, "failed to find any stream\n");
+            goto __FAIL;
+        }
+    }
+
+    if(!policy || !policy->quiet){
+        av_dump_format(input->pFormatContext, 0, url, 0);
+    }
+
+    ret = mp_packet_pool_init(&input->pool, MP_PACKET_POOL_SIZE);
+    if(ret < 0){
+        goto __FAIL;
+    }
+
+    return 0;
+
+__FAIL:
+    mp_close_input(input);
+    return ret;
+}
+
+void mp_close_input(MediaInput *input){
+    mp_packet_pool_uninit(&input->pool);
+
+    if(input->pFormatContext){
+        avformat_close_input(&input->pFormatContext);
+    }
+}
+
+int mp_find_stream(MediaInput *input, enum AVMediaType type){
+    for(int i = 0; i < input->pFormatContext->nb_streams; i++){
+        //first stream of the type wins, like the tools always did
+        if(input->pFormatContext->streams[i]->codecpar->codec_type == type){
+            return i;
+        }
+    }
+
+    return AVERROR_STREAM_NOT_FOUND;
+}
+
+int mp_run(MediaInput *input, int stream_index, const MediaSink *sink){
+    int ret = 0, err;
+    int64_t start;
+    AVPacket *pPacket = NULL;
+    AVFormatContext *pFormatContext = input->pFormatContext;
+
+    //let the demuxer skip payload of streams nobody reads
+    if(stream_index >= 0){
+        for(int i = 0; i < pFormatContext->nb_streams; i++){
+            if(i != stream_index){
+                pFormatContext->streams[i]->discard = AVDISCARD_ALL;
+            }
+        }
+    }
+
+    if(sink->open && (ret = sink->open(sink->opaque, input)) < 0){
+        goto end;
+    }
+
+    pPacket = mp_packet_pool_get(&input->pool);
+    if(!pPacket){
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    while(1){
+        start = ms_timer_start();
+        ret = av_read_frame(pFormatContext, pPacket);
+        ms_timer_stop(MS_READ_FRAME, start);
+
+        if(ret < 0){
+            break;
+        }
+
+        ms_count(MS_PACKETS, 1);
+        ms_count(MS_BYTES_IN, pPacket->size);
+
+        if(stream_index < 0 || pPacket->stream_index == stream_index){
+            ret = sink->write_packet(sink->opaque, input, pPacket);
+        }
+
+        av_packet_unref(pPacket);
+        ms_tick();
+
+        if(ret < 0){
+            break;
+        }
+    }
+
+    if(ret == AVERROR_EOF){
+        ret = 0;
+    }else if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "stopped reading %s: %s\n", input->url, av_err2str(ret));
+    }
+
+    mp_packet_pool_put(&input->pool, pPacket);
+
+end:
+    if(sink->close){
+        err = sink->close(sink->opaque, input);
+        if(ret >= 0){
+            ret = err;
+        }
+    }
+
+    return ret;
+}
+
+int mp_packet_pool_init(MediaPacketPool *pool, int nb_packets){
+    if(nb_packets > MP_PACKET_POOL_SIZE){
+        nb_packets = MP_PACKET_POOL_SIZE;
+    }
+
+    pool->nb_packets = 0;
+    pool->nb_free = 0;
+
+    for(int i = 0; i < nb_packets; i++){
+        pool->packets[i] = av_packet_alloc();
+        if(!pool->packets[i]){
+            mp_packet_pool_uninit(pool);
+            return AVERROR(ENOMEM);
+        }
+        pool->nb_packets++;
+        ms_count(MS_ALLOCS, 1);
+    }
+
+    pool->nb_free = pool->nb_packets;
+
+    return 0;
+}
+
+AVPacket *mp_packet_pool_get(MediaPacketPool *pool){
+    if(!pool->nb_free){
+        return NULL;
+    }
+
+    return pool->packets[--pool->nb_free];
+}
+
+void mp_packet_pool_put(MediaPacketPool *pool, AVPacket *pkt){
+    if(!pkt){
+        return;
+    }
+
+    av_packet_unref(pkt);
+    pool->packets[pool->nb_free++] = pkt;
+}
+
+void mp_packet_pool_uninit(MediaPacketPool *pool){
+    //packets still handed out are owned by the caller
+    for(int i = 0; i < pool->nb_free; i++){
+        av_packet_free(&pool->packets[i]);
+    }
+
+    pool->nb_packets = 0;
+    pool->nb_free = 0;
+}
+
+uint8_t *mp_arena_append(MediaArena *arena, size_t size){
+    uint8_t *tail;
+
+    if(arena->size + size > arena->capacity){
+        size_t capacity = arena->capacity ? arena->capacity : 4096;
+
+        while(capacity < arena->size + size){
+            capacity *= 2;
+        }
+
+        //keep the usual padding so the buffer can be handed to ffmpeg readers
+        if(av_reallocp(&arena->data, capacity + AV_INPUT_BUFFER_PADDING_SIZE) < 0){
+            arena->size = arena->capacity = 0;
+            return NULL;
+        }
+        arena->capacity = capacity;
+        ms_count(MS_ALLOCS, 1);
+    }
+
+    tail = arena->data + arena->size;
+    arena->size += size;
+
+    return tail;
+}
+
+void mp_arena_reset(MediaArena *arena){
+    arena->size = 0;
+}
+
+void mp_arena_free(MediaArena *arena){
+    av_freep(&arena->data);
+    arena->size = arena->capacity = 0;
+}
+
+//convert avcc extradata to start code prefixed sps/pps once per stream
+int mp_h264_annexb_init(MediaH264AnnexB *ctx, const AVCodecParameters *par){
+    static const uint8_t nalu_header[4] = {0, 0, 0, 1};
+    const uint8_t *extradata, *extradata_end;
+    uint64_t total_size = 0;
+    uint8_t *out = NULL;
+    int unit_nb, sps_done = 0, sps_seen = 0, pps_seen = 0;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    //annex-b extradata from ts or raw h264 starts with a start code, not version 1
+    if(!par->extradata || par->extradata_size < 7 || par->extradata[0] != 1){
+        av_log(NULL, AV_LOG_ERROR, "h264 stream has no avcc extradata\n");
+        return AVERROR(EINVAL);
+    }
+
+    //in extra data, first 4 bytes not used
+    extradata = par->extradata + 4;
+    extradata_end = par->extradata + par->extradata_size;
+    ctx->length_size = (*extradata++ & 0x3) + 1;
+
+    //sps units first, then pps units
+    unit_nb = *extradata++ & 0x1f;
+    sps_seen = unit_nb > 0;
+
+    while(1){
+        while(unit_nb--){
+            uint16_t unit_size;
+
+            if(extradata + 2 > extradata_end){
+                goto invalid;
+            }
+
+            unit_size = AV_RB16(extradata);
+            total_size += unit_size + 4;
+            if(total_size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE ||
+               extradata + 2 + unit_size > extradata_end){
+                goto invalid;
+            }
+
+            if(av_reallocp(&out, total_size + AV_INPUT_BUFFER_PADDING_SIZE) < 0){
+                return AVERROR(ENOMEM);
+            }
+            ms_count(MS_ALLOCS, 1);
+
+            memcpy(out + total_size - unit_size - 4, nalu_header, 4);
+            memcpy(out + total_size - unit_size, extradata + 2, unit_size);
+            extradata += 2 + unit_size;
+        }
+
+        if(sps_done++ || extradata >= extradata_end){
+            break;
+        }
+
+        unit_nb = *extradata++;
+        pps_seen = unit_nb > 0;
+    }
+
+    if(out){
+        memset(out + total_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    }
+
+    if(!sps_seen){
+        av_log(NULL, AV_LOG_WARNING, "Warning: SPS missing\n");
+    }
+
+    if(!pps_seen){
+        av_log(NULL, AV_LOG_WARNING, "Warning: PPS missing\n");
+    }
+
+    ctx->sps_pps = out;
+    ctx->sps_pps_size = total_size;
+
+    return 0;
+
+invalid:
+    av_log(NULL, AV_LOG_ERROR, "corrupted or invalid avcc extradata\n");
+    av_free(out);
+    return AVERROR_INVALIDDATA;
+}
+
+int mp_h264_annexb_filter(MediaH264AnnexB *ctx, const AVPacket *in, MediaArena *out){
+    const uint8_t *buf = in->data;
+    const uint8_t *buf_end = in->data + in->size;
+    int sps_pps_done = 0;
+
+    while(buf < buf_end){
+        uint8_t *dst;
+        uint8_t unit_type;
+        uint32_t nal_size = 0;
+        int start_code_size, sps_pps_size = 0;
+
+        if(buf_end - buf < ctx->length_size){
+            return AVERROR_INVALIDDATA;
+        }
+
+        for(int i = 0; i < ctx->length_size; i++){
+            nal_size = (nal_size << 8) | buf[i];
+        }
+        buf += ctx->length_size;
+
+        if(!nal_size || nal_size > buf_end - buf){
+            return AVERROR_INVALIDDATA;
+        }
+
+        unit_type = *buf & 0x1f;
+
+        //idr slices need sps/pps in front so decoders can start there
+        if(unit_type == 5 && !sps_pps_done){
+            sps_pps_size = ctx->sps_pps_size;
+            sps_pps_done = 1;
+        }else if(unit_type == 7 || unit_type == 8){
+            sps_pps_done = 1;
+        }
+
+        //4 byte start code for the first nal of an access unit, 3 afterwards
+        start_code_size = out->size ? 3 : 4;
+
+        dst = mp_arena_append(out, sps_pps_size + start_code_size + nal_size);
+        if(!dst){
+            return AVERROR(ENOMEM);
+        }
+
+        if(sps_pps_size){
+            memcpy(dst, ctx->sps_pps, sps_pps_size);
+            dst += sps_pps_size;
+        }
+
+        if(start_code_size == 4){
+            AV_WB32(dst, 1);
+        }else{
+            AV_WB24(dst, 1);
+        }
+
+        memcpy(dst + start_code_size, buf, nal_size);
+        buf += nal_size;
+    }
+
+    return 0;
+}
+
+void mp_h264_annexb_uninit(MediaH264AnnexB *ctx){
+    av_freep(&ctx->sps_pps);
+    ctx->sps_pps_size = 0;
+}
+
+int mp_nb_channels(const AVCodecParameters *par){
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
+    return par->ch_layout.nb_channels;
+#else
+    return par->channels;
+#endif
+}
+
+int mp_format_name(char *buf, size_t size, const char *pattern, int value){
+    const char *token = strstr(pattern, "%d");
+    int len;
+
+    //the pattern is a file name, never a format string
+    for(const char *p = strchr(pattern, '%'); p; p = strchr(p + 1, '%')){
+        if(p != token){
+            av_log(NULL, AV_LOG_ERROR, "%s: only a single %%d is allowed in the name\n", pattern);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    if(token){
+        len = snprintf(buf, size, "%.*s%d%s", (int)(token - pattern), pattern, value, token + 2);
+    }else{
+        len = snprintf(buf, size, "%s", pattern);
+    }
+
+    if(len < 0 || len >= size){
+        av_log(NULL, AV_LOG_ERROR, "%s: name too long\n", pattern);
+        return AVERROR(ENAMETOOLONG);
+    }
+
+    return token != NULL;
+}
+
+static unsigned asc_read(const uint8_t *data, int size, int *pos, int bits){
+    unsigned value = 0;
+
+    //past the end reads as zero, the caller checks what it got
+    for(; bits > 0; bits--, (*pos)++){
+        int bit = *pos < size * 8 ? (data[*pos >> 3] >> (7 - (*pos & 7))) & 1 : 0;
+        value = value << 1 | bit;
+    }
+
+    return value;
+}
+
+static int asc_object_type(const uint8_t *data, int size, int *pos){
+    int audio_object_type = asc_read(data, size, pos, 5);
+
+    return audio_object_type == 31 ? 32 + asc_read(data, size, pos, 6) : audio_object_type;
+}
+
+static int sample_rate_index(int sample_rate){
+    for(int i = 0; i < FF_ARRAY_ELEMS(adts_sample_rates); i++){
+        if(adts_sample_rates[i] == sample_rate){
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void mp_adts_header(uint8_t *header, const AVCodecParameters *par, int data_len){
+    int audio_object_type = 2;
+    int sampling_frequency_index = 4;
+    int channel_config = 2;
+    int adtsLen = data_len + 7;
+
+    if(mp_nb_channels(par) > 0 && mp_nb_channels(par) <= 7){
+        channel_config = mp_nb_channels(par);
+    }
+
+    //aac profiles are numbered from 0, object types from 1
+    if(par->profile >= 0 && par->profile <= 3){
+        audio_object_type = par->profile + 1;
+    }
+
+    if(sample_rate_index(par->sample_rate) >= 0){
+        sampling_frequency_index = sample_rate_index(par->sample_rate);
+    }
+
+    //the AudioSpecificConfig describes the core stream adts needs, sample_rate
+    //is the sbr output rate for he-aac
+    if(par->extradata && par->extradata_size >= 2){
+        int pos = 0;
+        int type = asc_object_type(par->extradata, par->extradata_size, &pos);
+        int index = asc_read(par->extradata, par->extradata_size, &pos, 4);
+        int channels;
+
+        if(index == 15){
+            index = sample_rate_index(asc_read(par->extradata, par->extradata_size, &pos, 24));
+        }
+        channels = asc_read(par->extradata, par->extradata_size, &pos, 4);
+
+        //explicit sbr and ps signalling is followed by the core object type
+        if(type == 5 || type == 29){
+            int extension_index = asc_read(par->extradata, par->extradata_size, &pos, 4);
+            if(extension_index == 15){
+                asc_read(par->extradata, par->extradata_size, &pos, 24);
+            }
+            type = asc_object_type(par->extradata, par->extradata_size, &pos);
+        }
+
+        if(pos <= par->extradata_size * 8){
+            //adts only has two bits for the profile
+            if(type >= 1 && type <= 4){
+                audio_object_type = type;
+            }
+            if(index >= 0 && index < FF_ARRAY_ELEMS(adts_sample_rates)){
+                sampling_frequency_index = index;
+            }
+            //0 means a program config element, keep the channel count
+            if(channels > 0 && channels <= 7){
+                channel_config = channels;
+            }
+        }
+    }
+
+    header[0] = 0xff;
+    header[1] = 0xf1;
+
+    header[2] = (audio_object_type - 1) << 6;
+    header[2] |= (sampling_frequency_index & 0x0f) << 2;
+    header[2] |= (channel_config & 0x04) >> 2;
+
+    header[3] = (channel_config & 0x03) << 6;
+    header[3] |= (adtsLen & 0x1800) >> 11;
+
+    header[4] = (uint8_t)((adtsLen & 0x7f8) >> 3);
+    header[5] = (uint8_t)((adtsLen & 0x7) << 5);
+    header[5] |= 0x1f;
+    header[6] = 0xfc;
+}
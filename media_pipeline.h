@@ -0,0 +1,94 @@
+#ifndef MEDIA_PIPELINE_H
+#define MEDIA_PIPELINE_H
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+//shared demux core used by the example tools, make builds it into
+//libmediapipeline.a and links every tool against it
+
+#define MP_PACKET_POOL_SIZE 8
+
+//how an input gets opened and probed, zero fields keep ffmpeg defaults
+typedef struct MediaProbePolicy {
+    int64_t probesize;
+    int64_t analyzeduration;
+    int skip_stream_info;
+    int quiet;
+    //read through this instead of opening url, the caller keeps ownership
+    AVIOContext *pb;
+} MediaProbePolicy;
+
+//fixed set of packets reused for the whole run
+typedef struct MediaPacketPool {
+    AVPacket *packets[MP_PACKET_POOL_SIZE];
+    int nb_packets;
+    int nb_free;
+} MediaPacketPool;
+
+//append-only buffer for rewritten payloads, reset per packet,
+//grows only until the biggest packet fits and never shrinks.
+//appending may move data, keep offsets instead of pointers
+typedef struct MediaArena {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} MediaArena;
+
+typedef struct MediaInput {
+    AVFormatContext *pFormatContext;
+    const char *url;
+    MediaPacketPool pool;
+} MediaInput;
+
+//where demuxed packets go, open and close are optional
+typedef struct MediaSink {
+    void *opaque;
+    int (*open)(void *opaque, MediaInput *input);
+    int (*write_packet)(void *opaque, MediaInput *input, AVPacket *pkt);
+    int (*close)(void *opaque, MediaInput *input);
+} MediaSink;
+
+//annex-b rewriting state for one avcc h264 stream
+typedef struct MediaH264AnnexB {
+    uint8_t *sps_pps;
+    int sps_pps_size;
+    int length_size;
+} MediaH264AnnexB;
+
+int mp_open_input(MediaInput *input, const char *url, const MediaProbePolicy *policy);
+void mp_close_input(MediaInput *input);
+
+//index of the first stream of the type, AVERROR_STREAM_NOT_FOUND if none
+int mp_find_stream(MediaInput *input, enum AVMediaType type);
+
+//feed every packet of stream_index, or of all streams when it is < 0, to sink
+int mp_run(MediaInput *input, int stream_index, const MediaSink *sink);
+
+int mp_packet_pool_init(MediaPacketPool *pool, int nb_packets);
+AVPacket *mp_packet_pool_get(MediaPacketPool *pool);
+void mp_packet_pool_put(MediaPacketPool *pool, AVPacket *pkt);
+void mp_packet_pool_uninit(MediaPacketPool *pool);
+
+uint8_t *mp_arena_append(MediaArena *arena, size_t size);
+void mp_arena_reset(MediaArena *arena);
+void mp_arena_free(MediaArena *arena);
+
+//fails unless the extradata is avcc, annex-b input needs no rewriting
+int mp_h264_annexb_init(MediaH264AnnexB *ctx, const AVCodecParameters *par);
+//rewrite one avcc packet as start code prefixed nal units appended to out
+int mp_h264_annexb_filter(MediaH264AnnexB *ctx, const AVPacket *in, MediaArena *out);
+void mp_h264_annexb_uninit(MediaH264AnnexB *ctx);
+
+//channel count across the old and the AVChannelLayout api
+int mp_nb_channels(const AVCodecParameters *par);
+
+//copy pattern to buf with its one %d replaced by value. 1 when it had a %d,
+//0 when copied as is, an error for any other % or when buf is too small
+int mp_format_name(char *buf, size_t size, const char *pattern, int value);
+
+//7 byte adts header for a raw aac frame of data_len bytes
+void mp_adts_header(uint8_t *header, const AVCodecParameters *par, int data_len);
+
+#endif
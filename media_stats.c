@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "media_stats.h"
+
+int ms_enabled = 0;
+
+static const char *timer_names[MS_NB_TIMERS] = {
+    [MS_OPEN_INPUT]       = "open_input",
+    [MS_FIND_STREAM_INFO] = "find_stream_info",
+    [MS_READ_FRAME]       = "read_frame",
+    [MS_REWRITE]          = "rewrite",
+    [MS_WRITE_FRAME]      = "write_frame",
+    [MS_IO]               = "io",
+    [MS_IO_WAIT]          = "io_wait",
+    [MS_RENDER]           = "render",
+    [MS_DECODE]           = "decode",
+    [MS_SCALE]            = "scale",
+    [MS_ENCODE]           = "encode",
+    [MS_ANALYZE]          = "analyze",
+};
+
+static const char *counter_names[MS_NB_COUNTERS] = {
+    [MS_PACKETS]   = "packets",
+    [MS_FRAMES]    = "frames",
+    [MS_BYTES_IN]  = "bytes_in",
+    [MS_BYTES_OUT] = "bytes_out",
+    [MS_ALLOCS]    = "allocs",
+};
+
+//updated with relaxed atomics, the writer threads record io time too
+static struct {
+    const char *tool;
+    const char *path;
+    int64_t start;
+    int64_t interval;
+    int64_t next_report;
+    int64_t timer_ns[MS_NB_TIMERS];
+    int64_t timer_calls[MS_NB_TIMERS];
+    int64_t counters[MS_NB_COUNTERS];
+} stats;
+
+int64_t ms_now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void ms_add_time(enum MediaStatsTimer timer, int64_t ns){
+    __atomic_fetch_add(&stats.timer_ns[timer], ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.timer_calls[timer], 1, __ATOMIC_RELAXED);
+}
+
+void ms_add(enum MediaStatsCounter counter, int64_t n){
+    __atomic_fetch_add(&stats.counters[counter], n, __ATOMIC_RELAXED);
+}
+
+//the tool name comes from argv[0], quote and control characters need escaping
+static void ms_print_string(FILE *fd, const char *str){
+    fputc('"', fd);
+    for(; *str; str++){
+        unsigned char c = *str;
+
+        if(c == '"' || c == '\\'){
+            fprintf(fd, "\\%c", c);
+        }else if(c < 0x20){
+            fprintf(fd, "\\u%04x", c);
+        }else{
+            fputc(c, fd);
+        }
+    }
+    fputc('"', fd);
+}
+
+static void ms_report(int final){
+    FILE *fd = stderr;
+    int64_t now = ms_now();
+
+    //reports are appended one json object per line
+    if(strcmp(stats.path, "-") && !(fd = fopen(stats.path, "a"))){
+        return;
+    }
+
+    fprintf(fd, "{\"tool\":");
+    ms_print_string(fd, stats.tool);
+    fprintf(fd, ",\"final\":%s,\"elapsed_ms\":%.3f,\"timers\":{",
+            final ? "true" : "false", (now - stats.start) / 1e6);
+
+    for(int i = 0; i < MS_NB_TIMERS; i++){
+        fprintf(fd, "%s\"%s\":{\"calls\":%lld,\"total_ms\":%.3f}", i ? "," : "", timer_names[i],
+                (long long)__atomic_load_n(&stats.timer_calls[i], __ATOMIC_RELAXED),
+                __atomic_load_n(&stats.timer_ns[i], __ATOMIC_RELAXED) / 1e6);
+    }
+
+    fprintf(fd, "},\"counters\":{");
+
+    for(int i = 0; i < MS_NB_COUNTERS; i++){
+        fprintf(fd, "%s\"%s\":%lld", i ? "," : "", counter_names[i],
+                (long long)__atomic_load_n(&stats.counters[i], __ATOMIC_RELAXED));
+    }
+
+    fprintf(fd, "}}\n");
+
+    if(fd != stderr){
+        fclose(fd);
+    }
+}
+
+static void ms_report_final(void){
+    ms_report(1);
+}
+
+void ms_init(const char *tool){
+    const char *path = getenv("MEDIA_STATS");
+    const char *interval = getenv("MEDIA_STATS_INTERVAL");
+    const char *name;
+
+    if(!path || !*path){
+        return;
+    }
+
+    name = strrchr(tool, '/');
+    stats.tool = name ? name + 1 : tool;
+    stats.path = path;
+    stats.start = ms_now();
+
+    if(interval && atof(interval) > 0){
+        stats.interval = (int64_t)(atof(interval) * 1e9);
+        stats.next_report = stats.start + stats.interval;
+    }
+
+    ms_enabled = 1;
+    atexit(ms_report_final);
+}
+
+void ms_tick(void){
+    int64_t now;
+
+    //the clock is a vdso call, cheap enough to read on every tick, and slow
+    //loops calling this once per large block still report on time
+    if(!ms_enabled || !stats.interval){
+        return;
+    }
+
+    now = ms_now();
+    if(now >= stats.next_report){
+        ms_report(0);
+        stats.next_report = now + stats.interval;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef MEDIA_STATS_H
+#define MEDIA_STATS_H
+
+#include <stdint.h>
+
+//hot path timers and counters shared by every tool.
+//off unless MEDIA_STATS is set to a file path or "-" for stderr, then a json
+//report is written at exit and every MEDIA_STATS_INTERVAL seconds if given.
+//when off each probe is a single predictable branch
+
+enum MediaStatsTimer {
+    MS_OPEN_INPUT,
+    MS_FIND_STREAM_INFO,
+    MS_READ_FRAME,
+    MS_REWRITE,
+    MS_WRITE_FRAME,
+    MS_IO,
+    MS_IO_WAIT,
+    MS_RENDER,
+    MS_DECODE,
+    MS_SCALE,
+    MS_ENCODE,
+    //measuring decoded media, such as audio peaks
+    MS_ANALYZE,
+    MS_NB_TIMERS
+};
+
+enum MediaStatsCounter {
+    MS_PACKETS,
+    MS_FRAMES,
+    MS_BYTES_IN,
+    MS_BYTES_OUT,
+    MS_ALLOCS,
+    MS_NB_COUNTERS
+};
+
+extern int ms_enabled;
+
+void ms_init(const char *tool);
+int64_t ms_now(void);
+void ms_add_time(enum MediaStatsTimer timer, int64_t ns);
+void ms_add(enum MediaStatsCounter counter, int64_t n);
+//emit a periodic report when the interval has passed
+void ms_tick(void);
+
+static inline int64_t ms_timer_start(void){
+    return ms_enabled ? ms_now() : 0;
+}
+
+static inline void ms_timer_stop(enum MediaStatsTimer timer, int64_t start){
+    if(ms_enabled){
+        ms_add_time(timer, ms_now() - start);
+    }
+}
+
+static inline void ms_count(enum MediaStatsCounter counter, int64_t n){
+    if(ms_enabled){
+        ms_add(counter, n);
+    }
+}
+
+#endif
@@ -1,28 +1,28 @@
 #include <libavutil/log.h>
 #include <libavformat/avformat.h>
 
+#include "media_pipeline.h"
+#include "media_stats.h"
+
 int main(int argc, char *argv[]){
 
     if(argc < 2){
-        av_log(NULL, AV_LOG_ERROR, "Please input media file url");
+        av_log(NULL, AV_LOG_ERROR, "Please input media file url\n");
         return -1;
     }
 
-    int ret = 0;
-    AVFormatContext *pFormatContext = NULL;
+    MediaInput input = { 0 };
+    //only the container header is needed to dump the format
+    MediaProbePolicy policy = { .skip_stream_info = 1 };
     
     av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
 
-    // av_register_all();
-
-    ret = avformat_open_input(&pFormatContext, argv[1], NULL, NULL);
-
-    if(ret < 0){
-        av_log(NULL, AV_LOG_ERROR, "avformat open failed %s\n", av_err2str(ret));
+    if(mp_open_input(&input, argv[1], &policy) < 0){
         return -1;
     }
 
-    av_dump_format(pFormatContext, 1, argv[1], 0);
+    mp_close_input(&input);
 
-    avformat_close_input(&pFormatContext);
-}
\ No newline at end of file
+    return 0;
+}
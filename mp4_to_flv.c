@@ -1,167 +1,732 @@
-#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include <libavutil/log.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
 
-int main(int argc, char *argv[]){
-    char *src = NULL;
-    char *dst = NULL;
-    FILE *dest_fd = NULL;
+#include "media_pipeline.h"
+#include "media_stats.h"
+#include "transcode_ladder.h"
 
-    int ret, i;
-    int stream_index = 0;
-    bool stream_found = false;
+#define FOLLOW_BUFFER_SIZE 65536
+#define FOLLOW_MAX_CHUNKS 256
 
-    AVPacket packet;
-    AVOutputFormat *pOutputFormat = NULL;
-    AVFormatContext *pInputFormatContext = NULL, *pOutputFormatContext = NULL;
+//bytes read after one wakeup and the time they were seen to land
+typedef struct FollowChunk {
+    int64_t start;
+    int64_t end;
+    int64_t landed_ns;
+} FollowChunk;
 
-    int *stream_mapping = NULL;
-    int stream_mapping_size = 0;
-    
-    av_log_set_level(AV_LOG_INFO);
+//reads a file that is still being written, at its end it sleeps on inotify
+//until the writer appends more, closes the file or timeout_ms pass quietly
+typedef struct FollowReader {
+    AVIOContext *pb;
+    int fd;
+    int inotify_fd;
+    int timeout_ms;
+    int closed;
+    int64_t pos;
+    int64_t landed_ns;
+    int64_t nb_waits;
+    FollowChunk chunks[FOLLOW_MAX_CHUNKS];
+    int nb_chunks;
+    int chunk_head;
+} FollowReader;
 
-    if(argc < 3){
-        av_log(NULL, AV_LOG_ERROR, 
-        "Please input source media file url and output video file url\n");
-        return -1;
+//several inputs are stream copied one after another into a single output,
+//each input after the first is rebased to start where the previous one ended
+typedef struct RemuxSink {
+    const char *dst;
+    AVFormatContext *pOutputFormatContext;
+    int *stream_mapping;
+    int stream_mapping_size;
+    int header_written;
+    int64_t nb_failed;
+
+    //per output stream, in the output time base
+    int64_t *end_ts;
+    int64_t *last_dts;
+    //for the current input, in AV_TIME_BASE units
+    int64_t input_start;
+    int64_t ts_offset;
+    int nb_inputs;
+
+    //set while a followed input is remuxed, packets go out unbuffered
+    FollowReader *follow;
+    int64_t nb_latency;
+    int64_t latency_sum_ns;
+    int64_t latency_max_ns;
+} RemuxSink;
+
+//next input opened and probed while the current one is remuxed
+typedef struct Prefetch {
+    pthread_t thread;
+    const char *url;
+    MediaInput input;
+    int ret;
+} Prefetch;
+
+static int follow_wait(FollowReader *reader){
+    uint8_t events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = reader->inotify_fd, .events = POLLIN };
+    int64_t start = ms_timer_start();
+    ssize_t len;
+    int ret;
+
+    while((ret = poll(&pfd, 1, reader->timeout_ms)) < 0 && errno == EINTR);
+    ms_timer_stop(MS_IO_WAIT, start);
+
+    if(ret < 0){
+        return AVERROR(errno);
+    }
+
+    if(!ret){
+        av_log(NULL, AV_LOG_INFO, "no new data for %d ms, finishing\n", reader->timeout_ms);
+        reader->closed = 1;
+        return 0;
     }
 
-    src = argv[1];
-    dst = argv[2];
+    reader->landed_ns = ms_now();
+    reader->nb_waits++;
 
-    if(!src || !dst){
-        av_log(NULL, AV_LOG_ERROR, "src or dst is NULL\n");
-        return -1;
+    //appends coalesce, one wakeup drains every queued event
+    while((len = read(reader->inotify_fd, events, sizeof(events))) > 0){
+        for(uint8_t *p = events; p < events + len; ){
+            const struct inotify_event *event = (const struct inotify_event *)p;
+
+            if(event->mask & (IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+                reader->closed = 1;
+            }
+            p += sizeof(*event) + event->len;
+        }
     }
 
-    ret = avformat_open_input(&pInputFormatContext, src, NULL, NULL);
+    return 0;
+}
 
-    if(ret < 0){
-        av_log(NULL, AV_LOG_ERROR, "avformat open failed %s\n", av_err2str(ret));
-        goto end;
+static void follow_record(FollowReader *reader, int64_t start, int64_t end){
+    FollowChunk *chunk;
+
+    //backlog that was there before the first wakeup has no landing time
+    if(!reader->landed_ns){
+        return;
+    }
+
+    if(reader->nb_chunks){
+        chunk = &reader->chunks[(reader->chunk_head + reader->nb_chunks - 1) % FOLLOW_MAX_CHUNKS];
+        if(chunk->landed_ns == reader->landed_ns && chunk->end == start){
+            chunk->end = end;
+            return;
+        }
+    }
+
+    if(reader->nb_chunks == FOLLOW_MAX_CHUNKS){
+        reader->chunk_head = (reader->chunk_head + 1) % FOLLOW_MAX_CHUNKS;
+        reader->nb_chunks--;
     }
 
-    dest_fd = fopen(dst, "wb");
-    if(!dest_fd){
-        av_log(NULL, AV_LOG_ERROR, "failed to open dst file\n");
-        goto end;
+    chunk = &reader->chunks[(reader->chunk_head + reader->nb_chunks++) % FOLLOW_MAX_CHUNKS];
+    chunk->start = start;
+    chunk->end = end;
+    chunk->landed_ns = reader->landed_ns;
+}
+
+//when the byte at pos was seen to land, 0 if unknown
+static int64_t follow_landed(FollowReader *reader, int64_t pos){
+    for(int i = 0; i < reader->nb_chunks; i++){
+        const FollowChunk *chunk = &reader->chunks[(reader->chunk_head + i) % FOLLOW_MAX_CHUNKS];
+
+        if(pos >= chunk->start && pos < chunk->end){
+            return chunk->landed_ns;
+        }
+    }
+
+    return 0;
+}
+
+static int follow_read(void *opaque, uint8_t *buf, int size){
+    FollowReader *reader = opaque;
+    int ret;
+
+    while(1){
+        int64_t start = ms_timer_start();
+        ssize_t len = read(reader->fd, buf, size);
+
+        ms_timer_stop(MS_IO, start);
+
+        if(len > 0){
+            follow_record(reader, reader->pos, reader->pos + len);
+            reader->pos += len;
+            return len;
+        }
+
+        if(len < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return AVERROR(errno);
+        }
+
+        //once the writer is gone, the read above has drained what it left
+        if(reader->closed){
+            return AVERROR_EOF;
+        }
+
+        if((ret = follow_wait(reader)) < 0){
+            return ret;
+        }
     }
+}
 
-    av_dump_format(pInputFormatContext, 0, src, 0);
+static void follow_close(FollowReader **preader){
+    FollowReader *reader = *preader;
 
-    if (avformat_find_stream_info(pInputFormatContext,  NULL) < 0) {
-        av_log(NULL, AV_LOG_ERROR, "failed to find any stream\n");
-        goto end;
+    if(!reader){
+        return;
     }
 
-    avformat_alloc_output_context2(&pOutputFormatContext, NULL, NULL, dst);
-    if(!pOutputFormatContext){
-        av_log(NULL, AV_LOG_ERROR, "failed to allocate output context\n");
-        goto end;
+    if(reader->pb){
+        av_freep(&reader->pb->buffer);
+        avio_context_free(&reader->pb);
+    }
+    if(reader->inotify_fd >= 0){
+        close(reader->inotify_fd);
     }
+    if(reader->fd >= 0){
+        close(reader->fd);
+    }
+
+    av_freep(preader);
+}
+
+//not seekable on purpose, a size taken now would cut the demuxer short
+static int follow_open(FollowReader **preader, const char *url, int timeout_ms){
+    FollowReader *reader = av_mallocz(sizeof(*reader));
+    uint8_t *buffer = NULL;
+    int ret;
+
+    if(!reader){
+        return AVERROR(ENOMEM);
+    }
+
+    *preader = reader;
+    reader->timeout_ms = timeout_ms;
+    reader->fd = -1;
 
-    stream_mapping_size = pInputFormatContext->nb_streams;
-    stream_mapping = av_malloc_array(stream_mapping_size, sizeof(*stream_mapping));
-    if(!stream_mapping){
+    //watch before the first read so no append can slip in between
+    reader->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(reader->inotify_fd < 0 ||
+       inotify_add_watch(reader->inotify_fd, url, IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF) < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to watch %s: %s\n", url, strerror(errno));
+        ret = AVERROR(errno);
+        goto __FAIL;
+    }
+
+    reader->fd = open(url, O_RDONLY | O_CLOEXEC);
+    if(reader->fd < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open %s: %s\n", url, strerror(errno));
+        ret = AVERROR(errno);
+        goto __FAIL;
+    }
+
+    buffer = av_malloc(FOLLOW_BUFFER_SIZE);
+    if(!buffer){
+        ret = AVERROR(ENOMEM);
+        goto __FAIL;
+    }
+
+    reader->pb = avio_alloc_context(buffer, FOLLOW_BUFFER_SIZE, 0, reader, follow_read, NULL, NULL);
+    if(!reader->pb){
+        av_free(buffer);
         ret = AVERROR(ENOMEM);
-        goto end;
+        goto __FAIL;
+    }
+
+    return 0;
+
+__FAIL:
+    follow_close(preader);
+    return ret;
+}
+
+static int follow_open_input(MediaInput *input, FollowReader **preader, const char *url,
+                             int timeout_ms, int quiet){
+    MediaProbePolicy policy = { .quiet = quiet };
+    int ret;
+
+    if((ret = follow_open(preader, url, timeout_ms)) < 0){
+        return ret;
     }
 
-    pOutputFormat = pOutputFormatContext->oformat;
+    policy.pb = (*preader)->pb;
+    ret = mp_open_input(input, url, &policy);
+    if(ret < 0){
+        follow_close(preader);
+    }
+
+    return ret;
+}
+
+static int keep_stream(const AVCodecParameters *par){
+    return par->codec_type == AVMEDIA_TYPE_VIDEO ||
+           par->codec_type == AVMEDIA_TYPE_AUDIO ||
+           par->codec_type == AVMEDIA_TYPE_SUBTITLE;
+}
+
+static int remux_output_open(RemuxSink *sink, MediaInput *input){
+    AVFormatContext *pInputFormatContext = input->pFormatContext;
+    AVFormatContext *pOutputFormatContext = NULL;
+    int ret, stream_index = 0;
+
+    avformat_alloc_output_context2(&sink->pOutputFormatContext, NULL, NULL, sink->dst);
+    pOutputFormatContext = sink->pOutputFormatContext;
+    if(!pOutputFormatContext){
+        av_log(NULL, AV_LOG_ERROR, "failed to allocate output context\n");
+        return AVERROR_UNKNOWN;
+    }
 
     for(int i = 0; i<pInputFormatContext->nb_streams; i++){
         AVStream *out_stream;
-        AVStream *in_stream = pInputFormatContext->streams[i];
         AVCodecParameters *in_codecpar = pInputFormatContext->streams[i]->codecpar;
-        if(in_codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
-           in_codecpar->codec_type != AVMEDIA_TYPE_AUDIO &&
-           in_codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE){
-           stream_mapping[i] = -1;
+        if(!keep_stream(in_codecpar)){
            continue;
         }
         
-        stream_mapping[i] = stream_index++;
+        stream_index++;
 
         out_stream = avformat_new_stream(pOutputFormatContext, NULL);
         if(!out_stream){
             av_log(NULL, AV_LOG_ERROR, "failed to allocate out stream\n");
-            goto end;
+            return AVERROR(ENOMEM);
         }
 
         ret = avcodec_parameters_copy(out_stream->codecpar, in_codecpar);
         if(ret < 0){
             av_log(NULL, AV_LOG_ERROR, "failed to copy codec parameters\n");
-            goto end;
+            return ret;
         }
 
         out_stream->codecpar->codec_tag = 0;
     }
 
-    av_dump_format(pOutputFormatContext, 0, dst, 1);
+    sink->end_ts = av_malloc_array(stream_index, sizeof(*sink->end_ts));
+    sink->last_dts = av_malloc_array(stream_index, sizeof(*sink->last_dts));
+    if(!sink->end_ts || !sink->last_dts){
+        return AVERROR(ENOMEM);
+    }
+
+    for(int i = 0; i < stream_index; i++){
+        sink->end_ts[i] = 0;
+        sink->last_dts[i] = AV_NOPTS_VALUE;
+    }
 
-    if(!(pOutputFormat->flags & AVFMT_NOFILE)){
-        ret = avio_open(&pOutputFormatContext->pb, dst, AVIO_FLAG_WRITE);
+    av_dump_format(pOutputFormatContext, 0, sink->dst, 1);
+
+    if(!(pOutputFormatContext->oformat->flags & AVFMT_NOFILE)){
+        ret = avio_open(&pOutputFormatContext->pb, sink->dst, AVIO_FLAG_WRITE);
         if(ret < 0){
             av_log(NULL, AV_LOG_ERROR, "failed to open output file\n");
-            goto end;
+            return ret;
         }
     }
 
     ret = avformat_write_header(pOutputFormatContext, NULL);
     if(ret < 0){
         av_log(NULL, AV_LOG_ERROR, "failed to write header\n");
-        goto end;
+        return ret;
     }
-    
-    //write every packet from input stream to output stream
-    //and change timebase related for each packet
-    while(1){
-        AVStream *in_stream, *out_stream;
+    sink->header_written = 1;
 
-        ret = av_read_frame(pInputFormatContext, &packet);
-        if(ret < 0)
-            break;
-        
-        in_stream = pInputFormatContext->streams[packet.stream_index];
-        if(packet.stream_index >= stream_mapping_size ||
-            stream_mapping[packet.stream_index]<0){
-            av_packet_unref(&packet);
+    return 0;
+}
+
+//stream copy only works when every input carries the same streams and codec setup
+static int check_compatible(RemuxSink *sink, AVFormatContext *pInputFormatContext){
+    int stream_index = 0;
+
+    for(int i = 0; i < pInputFormatContext->nb_streams; i++){
+        AVCodecParameters *in_codecpar = pInputFormatContext->streams[i]->codecpar;
+        AVCodecParameters *out_codecpar;
+
+        if(!keep_stream(in_codecpar)){
             continue;
         }
 
-        packet.stream_index = stream_mapping[packet.stream_index];
-        out_stream = pOutputFormatContext->streams[packet.stream_index];
-        
-        packet.pts = av_rescale_q_rnd(packet.pts, in_stream->time_base, out_stream->time_base,
-                                        AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-        packet.dts = av_rescale_q_rnd(packet.dts, in_stream->time_base, out_stream->time_base,
-                                        AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
-        packet.duration = av_rescale_q(packet.duration, in_stream->time_base, out_stream->time_base);
-        packet.pos = -1;
-
-        ret = av_interleaved_write_frame(pOutputFormatContext, &packet);
+        if(stream_index >= sink->pOutputFormatContext->nb_streams){
+            av_log(NULL, AV_LOG_ERROR, "input has more streams than the first one\n");
+            return AVERROR(EINVAL);
+        }
+
+        out_codecpar = sink->pOutputFormatContext->streams[stream_index++]->codecpar;
+
+        if(in_codecpar->codec_type != out_codecpar->codec_type ||
+           in_codecpar->codec_id != out_codecpar->codec_id){
+            av_log(NULL, AV_LOG_ERROR, "stream %d: %s does not match %s of the first input\n", i,
+                   avcodec_get_name(in_codecpar->codec_id), avcodec_get_name(out_codecpar->codec_id));
+            return AVERROR(EINVAL);
+        }
+
+        if((in_codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            (in_codecpar->width != out_codecpar->width || in_codecpar->height != out_codecpar->height)) ||
+           (in_codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+            (in_codecpar->sample_rate != out_codecpar->sample_rate ||
+             mp_nb_channels(in_codecpar) != mp_nb_channels(out_codecpar)))){
+            av_log(NULL, AV_LOG_ERROR, "stream %d: size or audio format differs from the first input\n", i);
+            return AVERROR(EINVAL);
+        }
+
+        //the flv sequence header is written once, later inputs must decode with it
+        if(in_codecpar->extradata_size != out_codecpar->extradata_size ||
+           (in_codecpar->extradata_size &&
+            memcmp(in_codecpar->extradata, out_codecpar->extradata, in_codecpar->extradata_size))){
+            av_log(NULL, AV_LOG_ERROR, "stream %d: codec extradata differs from the first input\n", i);
+            return AVERROR(EINVAL);
+        }
+    }
+
+    if(stream_index != sink->pOutputFormatContext->nb_streams){
+        av_log(NULL, AV_LOG_ERROR, "input has fewer streams than the first one\n");
+        return AVERROR(EINVAL);
+    }
+
+    return 0;
+}
+
+//map the streams of the next input and rebase it behind what was written so far
+static int remux_sink_open(void *opaque, MediaInput *input){
+    RemuxSink *sink = opaque;
+    AVFormatContext *pInputFormatContext = input->pFormatContext;
+    int ret, stream_index = 0;
+
+    ret = check_compatible(sink, pInputFormatContext);
+    if(ret < 0){
+        return ret;
+    }
+
+    if(pInputFormatContext->nb_streams > sink->stream_mapping_size){
+        ret = av_reallocp_array(&sink->stream_mapping, pInputFormatContext->nb_streams, sizeof(*sink->stream_mapping));
         if(ret < 0){
-            av_log(NULL, AV_LOG_ERROR, "failed to mux packet\n");
+            return ret;
         }
+    }
+    sink->stream_mapping_size = pInputFormatContext->nb_streams;
+
+    for(int i = 0; i < pInputFormatContext->nb_streams; i++){
+        sink->stream_mapping[i] = keep_stream(pInputFormatContext->streams[i]->codecpar) ? stream_index++ : -1;
+    }
+
+    //the first input keeps its timestamps as they are
+    sink->input_start = 0;
+    sink->ts_offset = 0;
+
+    if(sink->nb_inputs++){
+        if(pInputFormatContext->start_time != AV_NOPTS_VALUE){
+            sink->input_start = pInputFormatContext->start_time;
+        }
+
+        for(int i = 0; i < stream_index; i++){
+            AVStream *out_stream = sink->pOutputFormatContext->streams[i];
+            int64_t end = av_rescale_q(sink->end_ts[i], out_stream->time_base, AV_TIME_BASE_Q);
+
+            sink->ts_offset = FFMAX(sink->ts_offset, end);
+        }
+
+        av_log(NULL, AV_LOG_INFO, "appending %s at %.3fs\n", input->url, sink->ts_offset / (double)AV_TIME_BASE);
+    }
+
+    return 0;
+}
+
+static int64_t rebase_ts(RemuxSink *sink, int64_t ts, AVStream *in_stream, AVStream *out_stream){
+    if(ts == AV_NOPTS_VALUE){
+        return ts;
+    }
+
+    ts -= av_rescale_q(sink->input_start, AV_TIME_BASE_Q, in_stream->time_base);
+    ts = av_rescale_q_rnd(ts, in_stream->time_base, out_stream->time_base,
+                          AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX);
+
+    return ts + av_rescale_q(sink->ts_offset, AV_TIME_BASE_Q, out_stream->time_base);
+}
+
+//write every packet from input stream to output stream
+//and change timebase related for each packet
+static int remux_sink_write(void *opaque, MediaInput *input, AVPacket *packet){
+    RemuxSink *sink = opaque;
+    AVStream *in_stream, *out_stream;
+    int64_t start, pos = packet->pos;
+    int ret;
 
-        av_packet_unref(&packet);
+    if(packet->stream_index >= sink->stream_mapping_size ||
+        sink->stream_mapping[packet->stream_index]<0){
+        return 0;
+    }
+
+    in_stream = input->pFormatContext->streams[packet->stream_index];
+    packet->stream_index = sink->stream_mapping[packet->stream_index];
+    out_stream = sink->pOutputFormatContext->streams[packet->stream_index];
+    
+    packet->pts = rebase_ts(sink, packet->pts, in_stream, out_stream);
+    packet->dts = rebase_ts(sink, packet->dts, in_stream, out_stream);
+    packet->duration = av_rescale_q(packet->duration, in_stream->time_base, out_stream->time_base);
+    packet->pos = -1;
+
+    //reordering delay of the next input can reach back over the boundary
+    if(packet->dts != AV_NOPTS_VALUE){
+        int64_t *last_dts = &sink->last_dts[packet->stream_index];
+
+        if(*last_dts != AV_NOPTS_VALUE && packet->dts <= *last_dts){
+            packet->dts = *last_dts + 1;
+            if(packet->pts != AV_NOPTS_VALUE && packet->pts < packet->dts){
+                packet->pts = packet->dts;
+            }
+        }
+        *last_dts = packet->dts;
     }
 
-    av_write_trailer(pOutputFormatContext);
+    if(packet->dts != AV_NOPTS_VALUE || packet->pts != AV_NOPTS_VALUE){
+        int64_t end = (packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts) + packet->duration;
+        int64_t *end_ts = &sink->end_ts[packet->stream_index];
 
-end:
-    if(pInputFormatContext){
-        avformat_close_input(&pInputFormatContext);
+        *end_ts = FFMAX(*end_ts, end);
     }
 
+    ms_count(MS_BYTES_OUT, packet->size);
+
+    start = ms_timer_start();
+    if(sink->follow){
+        //a live input is already interleaved by its writer, waiting for
+        //the other streams here would only add latency
+        ret = av_write_frame(sink->pOutputFormatContext, packet);
+        if(ret >= 0 && sink->pOutputFormatContext->pb){
+            avio_flush(sink->pOutputFormatContext->pb);
+        }
+    }else{
+        ret = av_interleaved_write_frame(sink->pOutputFormatContext, packet);
+    }
+    ms_timer_stop(MS_WRITE_FRAME, start);
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to mux packet\n");
+        sink->nb_failed++;
+        return 0;
+    }
+
+    //from the wakeup that brought the packet's first byte to its flush
+    if(sink->follow && pos >= 0){
+        int64_t landed = follow_landed(sink->follow, pos);
+
+        if(landed){
+            int64_t latency = ms_now() - landed;
+
+            sink->nb_latency++;
+            sink->latency_sum_ns += latency;
+            sink->latency_max_ns = FFMAX(sink->latency_max_ns, latency);
+        }
+    }
+
+    return 0;
+}
+
+static int remux_output_close(RemuxSink *sink){
+    AVFormatContext *pOutputFormatContext = sink->pOutputFormatContext;
+    int ret = 0;
+
     if(pOutputFormatContext){
-        avformat_close_input(&pOutputFormatContext);
+        if(sink->header_written){
+            ret = av_write_trailer(pOutputFormatContext);
+        }
+
+        if(!(pOutputFormatContext->oformat->flags & AVFMT_NOFILE)){
+            avio_closep(&pOutputFormatContext->pb);
+        }
+
+        avformat_free_context(pOutputFormatContext);
+        sink->pOutputFormatContext = NULL;
     }
 
-    if(dest_fd){
-        fclose(dest_fd);
+    av_freep(&sink->stream_mapping);
+    av_freep(&sink->end_ts);
+    av_freep(&sink->last_dts);
+
+    //keep going past bad packets but do not report success
+    if(sink->nb_failed){
+        av_log(NULL, AV_LOG_ERROR, "%"PRId64" packets failed to mux\n", sink->nb_failed);
+        if(ret >= 0){
+            ret = AVERROR_INVALIDDATA;
+        }
     }
 
     return ret;
-}
\ No newline at end of file
+}
+
+static void *prefetch_thread(void *arg){
+    Prefetch *prefetch = arg;
+    MediaProbePolicy policy = { .quiet = 1 };
+
+    prefetch->ret = mp_open_input(&prefetch->input, prefetch->url, &policy);
+
+    return NULL;
+}
+
+//transcode the input into every rendition instead of stream copying it
+static int run_ladder(const TranscodeLadderOptions *options, MediaInput *input){
+    TranscodeLadder *ladder = NULL;
+    MediaSink sink;
+    int ret, err;
+
+    if((ret = tl_open(&ladder, options)) < 0){
+        return ret;
+    }
+
+    tl_sink(ladder, &sink);
+    ret = mp_run(input, -1, &sink);
+
+    err = tl_close(&ladder);
+
+    return ret < 0 ? ret : err;
+}
+
+int main(int argc, char *argv[]){
+    char *dst = NULL;
+    char **inputs = NULL;
+
+    int ret, err, opt, nb_inputs, follow = 0, timeout_ms = 10000;
+
+    MediaInput input = { 0 };
+    FollowReader *reader = NULL;
+    TranscodeLadderOptions ladder_options = { 0 };
+    Prefetch prefetch = { 0 };
+    RemuxSink remux_sink = { 0 };
+    MediaSink sink = {
+        .opaque = &remux_sink,
+        .open = remux_sink_open,
+        .write_packet = remux_sink_write,
+    };
+    
+    av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
+
+    //-f follows growing inputs until their writer closes them,
+    //-t seconds without new data also ends an input.
+    //-r WxH[:bitrate] transcodes one input into a rendition per -r, with
+    //-e encoder, -p preset and -j scale workers
+    while((opt = getopt(argc, argv, "ft:r:e:p:j:")) != -1){
+        switch(opt){
+        case 'f': follow = 1; break;
+        case 't': timeout_ms = atof(optarg) * 1000; break;
+        case 'r':
+            if(tl_add_rendition(&ladder_options, optarg) < 0){
+                return -1;
+            }
+            break;
+        case 'e': ladder_options.encoder = optarg; break;
+        case 'p': ladder_options.preset = optarg; break;
+        case 'j': ladder_options.nb_workers = atoi(optarg); break;
+        default: return -1;
+        }
+    }
+
+    if(argc - optind < 2 || timeout_ms <= 0){
+        av_log(NULL, AV_LOG_ERROR, 
+        "Please input source media file url(s) and output video file url\n");
+        return -1;
+    }
+
+    inputs = argv + optind;
+    nb_inputs = argc - optind - 1;
+    dst = argv[argc - 1];
+
+    if(ladder_options.nb_renditions && nb_inputs != 1){
+        av_log(NULL, AV_LOG_ERROR, "transcoding takes a single input\n");
+        return -1;
+    }
+
+    if(follow){
+        ret = follow_open_input(&input, &reader, inputs[0], timeout_ms, 0);
+    }else{
+        ret = mp_open_input(&input, inputs[0], NULL);
+    }
+    if(ret < 0){
+        return -1;
+    }
+
+    if(ladder_options.nb_renditions){
+        ladder_options.dst = dst;
+        ret = run_ladder(&ladder_options, &input);
+        mp_close_input(&input);
+        follow_close(&reader);
+        return ret < 0 ? -1 : 0;
+    }
+
+    remux_sink.dst = dst;
+    ret = remux_output_open(&remux_sink, &input);
+
+    for(int i = 0; ret >= 0 && i < nb_inputs; i++){
+        int prefetching = 0;
+
+        //a followed input may not be complete yet, it is opened in turn
+        if(i + 1 < nb_inputs && !follow){
+            prefetch.url = inputs[i + 1];
+            prefetching = !pthread_create(&prefetch.thread, NULL, prefetch_thread, &prefetch);
+        }
+
+        remux_sink.follow = reader;
+        ret = mp_run(&input, -1, &sink);
+        remux_sink.follow = NULL;
+        mp_close_input(&input);
+        follow_close(&reader);
+
+        if(i + 1 == nb_inputs){
+            break;
+        }
+
+        //no thread means no overlap, not no output
+        if(follow){
+            if(ret < 0){
+                break;
+            }
+            prefetch.ret = follow_open_input(&prefetch.input, &reader, inputs[i + 1], timeout_ms, 1);
+        }else if(prefetching){
+            pthread_join(prefetch.thread, NULL);
+        }else{
+            prefetch_thread(&prefetch);
+        }
+
+        if(ret < 0 || prefetch.ret < 0){
+            if(prefetch.ret >= 0){
+                mp_close_input(&prefetch.input);
+            }
+            ret = ret < 0 ? ret : prefetch.ret;
+            break;
+        }
+
+        input = prefetch.input;
+        av_dump_format(input.pFormatContext, 0, input.url, 0);
+    }
+
+    if(ret < 0 && input.pFormatContext){
+        mp_close_input(&input);
+    }
+    follow_close(&reader);
+
+    if(remux_sink.nb_latency){
+        av_log(NULL, AV_LOG_INFO, "disk to flv latency over %"PRId64" packets: mean %.3f ms, max %.3f ms\n",
+               remux_sink.nb_latency, remux_sink.latency_sum_ns / 1e6 / remux_sink.nb_latency,
+               remux_sink.latency_max_ns / 1e6);
+    }
+
+    err = remux_output_close(&remux_sink);
+    if(ret >= 0){
+        ret = err;
+    }
+
+    return ret < 0 ? -1 : 0;
+}
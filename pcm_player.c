@@ -1,5 +1,7 @@
 #include <SDL2/SDL.h>
 
+#include "media_stats.h"
+
 #define BLOCK_SIZE 4096*1024
 
 static size_t buffer_len = 0;
@@ -25,8 +27,12 @@ int main(int argc, char *argv[]){
     
 
     FILE *audio_fd = NULL;
+    int64_t start;
 
     char *path = "./1.pcm";
+
+    ms_init(argv[0]);
+
     if(SDL_Init(SDL_INIT_AUDIO)){
         SDL_Log("failed to init!");
         return ret;
@@ -62,7 +68,11 @@ int main(int argc, char *argv[]){
     SDL_Delay(3000);
 
     do{
+        start = ms_timer_start();
         buffer_len = fread(audio_buf, 1, BLOCK_SIZE, audio_fd);
+        ms_timer_stop(MS_IO, start);
+        ms_count(MS_BYTES_IN, buffer_len);
+        ms_tick();
         audio_pos = audio_buf;
         while(audio_pos < (audio_buf + buffer_len)){
             SDL_Delay(1);
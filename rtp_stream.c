@@ -0,0 +1,700 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <libavutil/log.h>
+#include <libavutil/random_seed.h>
+#include <libavformat/avformat.h>
+
+#include "media_pipeline.h"
+#include "media_stats.h"
+
+//sends the h264 (rfc 6184) or aac (rfc 3640) stream of a media file as rtp
+//over udp, paced by packet timestamps. -R receives such a stream instead and
+//reports loss and interarrival jitter, which makes a loopback check:
+//  rtp_stream -R 127.0.0.1:5004 & rtp_stream in.mp4 127.0.0.1:5004
+
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD_TYPE 96
+#define RTP_DEFAULT_MTU 1400
+#define RTP_MAX_BATCH 64
+#define RTP_MAX_PACKET 1500
+#define RTP_RECV_SIZE 2048
+//sequence numbers remembered behind the highest one to tell late from repeated
+#define RTP_SEQ_WINDOW 1024
+
+//one preallocated datagram, rtp header, fu-a or au header, then payload
+typedef struct RtpSlot {
+    uint8_t data[RTP_MAX_PACKET];
+    struct iovec iov;
+} RtpSlot;
+
+typedef struct RtpSender {
+    int fd;
+    int stream_index;
+    int mtu;
+    int pace;
+    int batch_size;
+    const char *sdp_path;
+    const char *url;
+
+    enum AVCodecID codec_id;
+    AVRational time_base;
+    int clock_rate;
+    uint16_t seq;
+    uint32_t ssrc;
+    uint32_t ts_offset;
+
+    int avcc;
+    MediaH264AnnexB annexb;
+    MediaArena arena;
+
+    //payloads are copied in, so a batch may span several AVPackets
+    RtpSlot slots[RTP_MAX_BATCH];
+    struct mmsghdr msgs[RTP_MAX_BATCH];
+    int nb_queued;
+
+    int64_t first_dts;
+    int64_t start_ns;
+    int64_t due_ns;
+    int refused;
+
+    int64_t nb_sent;
+    int64_t nb_calls;
+    int64_t nb_batches;
+    int64_t late_sum_ns;
+    int64_t late_max_ns;
+} RtpSender;
+
+static int open_socket(const char *addr, int passive){
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *res = NULL;
+    char host[256];
+    const char *port = strrchr(addr, ':');
+    int fd = -1, ret, buf_size = 4 << 20;
+
+    if(!port || port - addr >= sizeof(host)){
+        av_log(NULL, AV_LOG_ERROR, "address %s is not host:port\n", addr);
+        return AVERROR(EINVAL);
+    }
+
+    memcpy(host, addr, port - addr);
+    host[port - addr] = 0;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    if((ret = getaddrinfo(host[0] ? host : NULL, port + 1, &hints, &res))){
+        av_log(NULL, AV_LOG_ERROR, "failed to resolve %s: %s\n", addr, gai_strerror(ret));
+        return AVERROR(EINVAL);
+    }
+
+    fd = socket(res->ai_family, SOCK_DGRAM, 0);
+    if(fd < 0){
+        ret = AVERROR(errno);
+        goto end;
+    }
+
+    //a whole access unit goes out in one burst, keep room for it
+    setsockopt(fd, SOL_SOCKET, passive ? SO_RCVBUF : SO_SNDBUF, &buf_size, sizeof(buf_size));
+
+    if(passive){
+        int on = 1;
+
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        ret = bind(fd, res->ai_addr, res->ai_addrlen);
+    }else{
+        ret = connect(fd, res->ai_addr, res->ai_addrlen);
+    }
+
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to %s %s\n", passive ? "bind" : "connect", addr);
+        ret = AVERROR(errno);
+        close(fd);
+        goto end;
+    }
+
+    ret = fd;
+
+end:
+    freeaddrinfo(res);
+
+    return ret;
+}
+
+static int flush_queue(RtpSender *s){
+    int done = 0;
+    int64_t start = ms_timer_start();
+
+    while(done < s->nb_queued){
+        int ret = sendmmsg(s->fd, s->msgs + done, s->nb_queued - done, 0);
+
+        if(ret < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            //nobody listening yet on a connected socket, drop and go on
+            if(errno == ECONNREFUSED){
+                if(!s->refused++){
+                    av_log(NULL, AV_LOG_WARNING, "receiver refused packets, dropping\n");
+                }
+                break;
+            }
+            av_log(NULL, AV_LOG_ERROR, "sendmmsg failed: %s\n", strerror(errno));
+            s->nb_queued = 0;
+            return AVERROR(errno);
+        }
+
+        for(int i = done; i < done + ret; i++){
+            ms_count(MS_BYTES_OUT, s->msgs[i].msg_len);
+        }
+        done += ret;
+        s->nb_calls++;
+    }
+
+    ms_timer_stop(MS_IO, start);
+
+    if(s->pace && s->nb_queued){
+        int64_t late = ms_now() - s->due_ns;
+
+        late = late > 0 ? late : 0;
+        s->late_sum_ns += late;
+        s->late_max_ns = late > s->late_max_ns ? late : s->late_max_ns;
+        s->nb_batches++;
+    }
+
+    s->nb_sent += done;
+    s->nb_queued = 0;
+
+    return 0;
+}
+
+static int queue_packet(RtpSender *s, const uint8_t *extra, int extra_size,
+                        const uint8_t *payload, int size, int marker, uint32_t timestamp){
+    RtpSlot *slot;
+    uint8_t *h;
+    int ret;
+
+    if(s->nb_queued == s->batch_size && (ret = flush_queue(s)) < 0){
+        return ret;
+    }
+
+    slot = &s->slots[s->nb_queued];
+    h = slot->data;
+
+    h[0] = 0x80;
+    h[1] = (marker ? 0x80 : 0) | RTP_PAYLOAD_TYPE;
+    AV_WB16(h + 2, s->seq);
+    AV_WB32(h + 4, timestamp);
+    AV_WB32(h + 8, s->ssrc);
+    if(extra_size){
+        memcpy(h + RTP_HEADER_SIZE, extra, extra_size);
+    }
+    memcpy(h + RTP_HEADER_SIZE + extra_size, payload, size);
+    slot->iov.iov_len = RTP_HEADER_SIZE + extra_size + size;
+    s->seq++;
+
+    s->nb_queued++;
+
+    return 0;
+}
+
+//single nal unit packets when they fit, fu-a fragments otherwise
+static int send_nal(RtpSender *s, const uint8_t *nal, int size, int last, uint32_t timestamp){
+    int max_payload = s->mtu - RTP_HEADER_SIZE;
+    uint8_t fu[2];
+    int ret;
+
+    if(size <= max_payload){
+        return queue_packet(s, NULL, 0, nal, size, last, timestamp);
+    }
+
+    fu[0] = (nal[0] & 0xe0) | 28;
+    fu[1] = 0x80 | (nal[0] & 0x1f);
+    max_payload -= 2;
+
+    //the nal header byte lives on in the fu indicator and header
+    for(nal++, size--; size > 0; nal += max_payload, size -= max_payload){
+        int len = size > max_payload ? max_payload : size;
+        int end = len == size;
+
+        if(end){
+            fu[1] |= 0x40;
+        }
+        if((ret = queue_packet(s, fu, 2, nal, len, last && end, timestamp)) < 0){
+            return ret;
+        }
+        fu[1] &= ~0x80;
+    }
+
+    return 0;
+}
+
+static const uint8_t *find_start_code(const uint8_t *p, const uint8_t *end){
+    for(; p + 3 <= end; p++){
+        if(!p[0] && !p[1] && p[2] == 1){
+            return p;
+        }
+    }
+
+    return end;
+}
+
+static int send_h264(RtpSender *s, const AVPacket *pPacket, uint32_t timestamp){
+    const uint8_t *buf = pPacket->data;
+    const uint8_t *end = pPacket->data + pPacket->size;
+    const uint8_t *nal, *next;
+    int ret;
+
+    //mp4 style input is rewritten to annex-b first, ts input already is
+    if(s->avcc){
+        mp_arena_reset(&s->arena);
+        if((ret = mp_h264_annexb_filter(&s->annexb, pPacket, &s->arena)) < 0){
+            av_log(NULL, AV_LOG_WARNING, "skipping malformed h264 packet\n");
+            return 0;
+        }
+        buf = s->arena.data;
+        end = s->arena.data + s->arena.size;
+    }
+
+    nal = find_start_code(buf, end);
+    while(nal < end){
+        const uint8_t *nal_end;
+
+        nal += 3;
+        next = find_start_code(nal, end);
+
+        //zeros in front of the next start code belong to neither nal
+        for(nal_end = next; nal_end > nal && !nal_end[-1]; nal_end--);
+
+        if(nal_end > nal && (ret = send_nal(s, nal, nal_end - nal, next == end, timestamp)) < 0){
+            return ret;
+        }
+        nal = next;
+    }
+
+    return 0;
+}
+
+//one au per packet with a single 13/3 bit au header, large frames are
+//fragmented and every fragment carries the size of the whole au
+static int send_aac(RtpSender *s, const AVPacket *pPacket, uint32_t timestamp){
+    const uint8_t *data = pPacket->data;
+    int size = pPacket->size;
+    int max_payload = s->mtu - RTP_HEADER_SIZE - 4;
+    uint8_t au[4];
+    int ret;
+
+    //ts input carries adts framing, rtp wants the raw frame
+    if(size >= 7 && data[0] == 0xff && (data[1] & 0xf6) == 0xf0){
+        int header_size = (data[1] & 0x01) ? 7 : 9;
+
+        data += header_size;
+        size -= header_size;
+    }
+
+    if(size <= 0 || size >= (1 << 13)){
+        av_log(NULL, AV_LOG_WARNING, "skipping aac frame of %d bytes\n", size);
+        return 0;
+    }
+
+    AV_WB16(au, 16);
+    AV_WB16(au + 2, size << 3);
+
+    for(; size > 0; data += max_payload, size -= max_payload){
+        int len = size > max_payload ? max_payload : size;
+
+        if((ret = queue_packet(s, au, 4, data, len, len == size, timestamp)) < 0){
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static void sleep_until(int64_t ns){
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+//sdp from ffmpeg's rtp muxer, it describes exactly this packetization
+static void write_sdp(RtpSender *s, const AVCodecParameters *par){
+    AVFormatContext *pSdpContext = NULL;
+    AVStream *pStream;
+    char url[1024], sdp[4096];
+    FILE *fd;
+
+    snprintf(url, sizeof(url), "rtp://%s", s->url);
+
+    if(avformat_alloc_output_context2(&pSdpContext, NULL, "rtp", url) < 0 ||
+       !(pStream = avformat_new_stream(pSdpContext, NULL)) ||
+       avcodec_parameters_copy(pStream->codecpar, par) < 0 ||
+       av_sdp_create(&pSdpContext, 1, sdp, sizeof(sdp)) < 0){
+        av_log(NULL, AV_LOG_WARNING, "failed to create sdp\n");
+        goto end;
+    }
+
+    if(!(fd = fopen(s->sdp_path, "w"))){
+        av_log(NULL, AV_LOG_WARNING, "failed to open %s\n", s->sdp_path);
+        goto end;
+    }
+    fputs(sdp, fd);
+    fputc('\n', fd);
+    fclose(fd);
+
+end:
+    avformat_free_context(pSdpContext);
+}
+
+static int rtp_sink_open(void *opaque, MediaInput *input){
+    RtpSender *s = opaque;
+    AVStream *pStream = input->pFormatContext->streams[s->stream_index];
+    AVCodecParameters *pCodecParameters = pStream->codecpar;
+    int ret;
+
+    s->codec_id = pCodecParameters->codec_id;
+    s->time_base = pStream->time_base;
+    s->first_dts = AV_NOPTS_VALUE;
+
+    if(s->codec_id == AV_CODEC_ID_H264){
+        s->clock_rate = 90000;
+        s->avcc = pCodecParameters->extradata_size > 0 && pCodecParameters->extradata[0] == 1;
+        if(s->avcc && (ret = mp_h264_annexb_init(&s->annexb, pCodecParameters)) < 0){
+            return ret;
+        }
+    }else if(s->codec_id == AV_CODEC_ID_AAC){
+        s->clock_rate = pCodecParameters->sample_rate;
+    }else{
+        av_log(NULL, AV_LOG_ERROR, "cannot packetize %s, only h264 and aac\n",
+               avcodec_get_name(s->codec_id));
+        return AVERROR_PATCHWELCOME;
+    }
+
+    if(s->sdp_path){
+        write_sdp(s, pCodecParameters);
+    }
+
+    s->seq = av_get_random_seed();
+    s->ssrc = av_get_random_seed();
+    s->ts_offset = av_get_random_seed();
+
+    for(int i = 0; i < RTP_MAX_BATCH; i++){
+        s->slots[i].iov.iov_base = s->slots[i].data;
+        s->msgs[i].msg_hdr.msg_iov = &s->slots[i].iov;
+        s->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return 0;
+}
+
+static int rtp_sink_write(void *opaque, MediaInput *input, AVPacket *pPacket){
+    RtpSender *s = opaque;
+    int64_t pts = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+    int64_t dts = pPacket->dts != AV_NOPTS_VALUE ? pPacket->dts : pts;
+    uint32_t timestamp;
+    int ret;
+
+    if(pts == AV_NOPTS_VALUE){
+        av_log(NULL, AV_LOG_WARNING, "skipping packet without timestamps\n");
+        return 0;
+    }
+
+    //decode order is send order, dts sets the pace relative to the first packet
+    if(s->first_dts == AV_NOPTS_VALUE){
+        s->first_dts = dts;
+        s->start_ns = ms_now();
+    }
+
+    if(s->pace){
+        s->due_ns = s->start_ns + av_rescale_q(dts - s->first_dts, s->time_base, (AVRational){1, 1000000000});
+        if(s->due_ns > ms_now()){
+            sleep_until(s->due_ns);
+        }
+    }
+
+    timestamp = av_rescale_q(pts, s->time_base, (AVRational){1, s->clock_rate}) + s->ts_offset;
+
+    if(s->codec_id == AV_CODEC_ID_H264){
+        ret = send_h264(s, pPacket, timestamp);
+    }else{
+        ret = send_aac(s, pPacket, timestamp);
+    }
+
+    //paced output leaves with its frame, unpaced output fills whole batches
+    if(ret >= 0 && s->pace){
+        ret = flush_queue(s);
+    }
+
+    return ret;
+}
+
+static int rtp_sink_close(void *opaque, MediaInput *input){
+    RtpSender *s = opaque;
+    int ret = flush_queue(s);
+
+    mp_h264_annexb_uninit(&s->annexb);
+    mp_arena_free(&s->arena);
+
+    return ret;
+}
+
+typedef struct RtpReceiver {
+    int clock_rate;
+    int64_t nb_packets;
+    int64_t nb_bytes;
+    int64_t nb_reordered;
+    int64_t nb_duplicated;
+    uint32_t ssrc;
+    uint16_t base_seq;
+    uint16_t max_seq;
+    int64_t cycles;
+    uint64_t seen[RTP_SEQ_WINDOW / 64];
+    double transit;
+    double jitter;
+} RtpReceiver;
+
+static int seq_seen(const RtpReceiver *r, uint16_t seq){
+    return (r->seen[(seq % RTP_SEQ_WINDOW) / 64] >> (seq % 64)) & 1;
+}
+
+static void seq_mark(RtpReceiver *r, uint16_t seq, int seen){
+    uint64_t bit = (uint64_t)1 << (seq % 64);
+
+    if(seen){
+        r->seen[(seq % RTP_SEQ_WINDOW) / 64] |= bit;
+    }else{
+        r->seen[(seq % RTP_SEQ_WINDOW) / 64] &= ~bit;
+    }
+}
+
+static void receive_packet(RtpReceiver *r, const uint8_t *buf, int size, int64_t arrival_ns){
+    uint16_t seq;
+    uint32_t timestamp;
+    double transit;
+
+    if(size < RTP_HEADER_SIZE || (buf[0] & 0xc0) != 0x80){
+        return;
+    }
+
+    seq = AV_RB16(buf + 2);
+    timestamp = AV_RB32(buf + 4);
+    transit = arrival_ns * 1e-9 * r->clock_rate - timestamp;
+
+    if(!r->nb_packets){
+        r->ssrc = AV_RB32(buf + 8);
+        r->base_seq = r->max_seq = seq;
+        r->transit = transit;
+        seq_mark(r, seq, 1);
+    }else{
+        uint16_t delta = seq - r->max_seq;
+        uint16_t behind = r->max_seq - seq;
+
+        if(delta && delta < 0x8000){
+            //forget what the window slides past
+            for(uint16_t i = 1; i <= FFMIN(delta, RTP_SEQ_WINDOW); i++){
+                seq_mark(r, r->max_seq + i, 0);
+            }
+            if(seq < r->max_seq){
+                r->cycles += 65536;
+            }
+            r->max_seq = seq;
+        }else if(behind >= RTP_SEQ_WINDOW || seq_seen(r, seq)){
+            //a repeat, or too old to tell, counting it would hide a loss
+            r->nb_duplicated++;
+            return;
+        }else{
+            r->nb_reordered++;
+        }
+        seq_mark(r, seq, 1);
+
+        //rfc 3550 interarrival jitter in clock rate units
+        r->jitter += (fabs(transit - r->transit) - r->jitter) / 16;
+        r->transit = transit;
+    }
+
+    r->nb_packets++;
+    r->nb_bytes += size;
+}
+
+static int64_t arrival_time(struct msghdr *msg){
+    struct timespec now;
+
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS){
+            struct timespec ts;
+
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+    }
+
+    //same clock as the kernel stamps, ms_now is monotonic and would skew the jitter
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//receives until the stream stops for idle_ms, 0 when nothing was lost
+static int run_receiver(const char *addr, int clock_rate, int idle_ms){
+    static uint8_t bufs[RTP_MAX_BATCH][RTP_RECV_SIZE];
+    static uint8_t controls[RTP_MAX_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+    struct mmsghdr msgs[RTP_MAX_BATCH];
+    struct iovec iovs[RTP_MAX_BATCH];
+    RtpReceiver r = { .clock_rate = clock_rate };
+    int64_t expected, lost;
+    int fd = open_socket(addr, 1);
+
+    if(fd < 0){
+        return -1;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "listening on %s\n", addr);
+
+    while(1){
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, r.nb_packets ? idle_ms : -1);
+
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            break;
+        }
+
+        for(int i = 0; i < RTP_MAX_BATCH; i++){
+            iovs[i] = (struct iovec){ .iov_base = bufs[i], .iov_len = RTP_RECV_SIZE };
+            msgs[i].msg_hdr = (struct msghdr){
+                .msg_iov = &iovs[i],
+                .msg_iovlen = 1,
+                .msg_control = controls[i],
+                .msg_controllen = sizeof(controls[i]),
+            };
+        }
+
+        ret = recvmmsg(fd, msgs, RTP_MAX_BATCH, MSG_DONTWAIT, NULL);
+        if(ret < 0){
+            if(errno == EAGAIN || errno == EINTR){
+                continue;
+            }
+            av_log(NULL, AV_LOG_ERROR, "recvmmsg failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for(int i = 0; i < ret; i++){
+            receive_packet(&r, bufs[i], msgs[i].msg_len, arrival_time(&msgs[i].msg_hdr));
+        }
+    }
+
+    close(fd);
+
+    if(!r.nb_packets){
+        av_log(NULL, AV_LOG_ERROR, "no rtp packets received\n");
+        return -1;
+    }
+
+    expected = r.cycles + r.max_seq - r.base_seq + 1;
+    lost = expected - r.nb_packets;
+
+    av_log(NULL, AV_LOG_INFO,
+           "ssrc %08x: %"PRId64" packets, %"PRId64" bytes, lost %"PRId64", reordered %"PRId64", "
+           "duplicated %"PRId64", jitter %.3f ms\n",
+           r.ssrc, r.nb_packets, r.nb_bytes, lost, r.nb_reordered, r.nb_duplicated,
+           r.jitter * 1000 / r.clock_rate);
+
+    return lost > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[]){
+    int ret = 0, opt, receive = 0, audio = 0;
+    int clock_rate = 90000, idle_ms = 2000;
+
+    MediaInput input = { 0 };
+    RtpSender sender = {
+        .fd = -1,
+        .mtu = RTP_DEFAULT_MTU,
+        .pace = 1,
+        .batch_size = RTP_MAX_BATCH,
+    };
+    MediaSink sink = {
+        .opaque = &sender,
+        .open = rtp_sink_open,
+        .write_packet = rtp_sink_write,
+        .close = rtp_sink_close,
+    };
+
+    av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
+
+    //send: -a audio instead of video, -n no pacing, -b packets per sendmmsg,
+    //-m mtu, -s sdp file. receive: -R, -c clock rate, -i idle timeout in ms
+    while((opt = getopt(argc, argv, "anb:m:s:Rc:i:")) != -1){
+        switch(opt){
+        case 'a': audio = 1; break;
+        case 'n': sender.pace = 0; break;
+        case 'b': sender.batch_size = atoi(optarg); break;
+        case 'm': sender.mtu = atoi(optarg); break;
+        case 's': sender.sdp_path = optarg; break;
+        case 'R': receive = 1; break;
+        case 'c': clock_rate = atoi(optarg); break;
+        case 'i': idle_ms = atoi(optarg); break;
+        default: return -1;
+        }
+    }
+
+    if(receive){
+        if(argc - optind < 1 || clock_rate <= 0){
+            av_log(NULL, AV_LOG_ERROR, "Please input the host:port to listen on\n");
+            return -1;
+        }
+        return run_receiver(argv[optind], clock_rate, idle_ms);
+    }
+
+    if(argc - optind < 2 || sender.batch_size < 1 || sender.batch_size > RTP_MAX_BATCH ||
+       sender.mtu < RTP_HEADER_SIZE + 16 || sender.mtu > RTP_MAX_PACKET){
+        av_log(NULL, AV_LOG_ERROR,
+        "Please input source media file url and destination host:port\n");
+        return -1;
+    }
+
+    sender.url = argv[optind + 1];
+    sender.fd = open_socket(sender.url, 0);
+    if(sender.fd < 0){
+        return -1;
+    }
+
+    ret = mp_open_input(&input, argv[optind], NULL);
+    if(ret < 0){
+        goto __FAIL;
+    }
+
+    sender.stream_index = mp_find_stream(&input, audio ? AVMEDIA_TYPE_AUDIO : AVMEDIA_TYPE_VIDEO);
+    if(sender.stream_index < 0){
+        av_log(NULL, AV_LOG_ERROR, "no %s stream found from input media file!\n", audio ? "audio" : "video");
+        ret = sender.stream_index;
+        goto __FAIL;
+    }
+
+    ret = mp_run(&input, sender.stream_index, &sink);
+
+    av_log(NULL, AV_LOG_INFO, "sent %"PRId64" rtp packets in %"PRId64" sendmmsg calls\n",
+           sender.nb_sent, sender.nb_calls);
+    if(sender.nb_batches){
+        av_log(NULL, AV_LOG_INFO, "send lateness mean %.1f us, max %.1f us\n",
+               sender.late_sum_ns / 1e3 / sender.nb_batches, sender.late_max_ns / 1e3);
+    }
+
+__FAIL:
+    mp_close_input(&input);
+    close(sender.fd);
+
+    return ret < 0 ? -1 : 0;
+}
@@ -4,6 +4,8 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_render.h>
 
+#include "media_stats.h"
+
 #define REFRESH_EVENT (SDL_USEREVENT + 1)
 #define QUIT_EVENT (SDL_USEREVENT + 2)
 #define DELAY 16
@@ -55,6 +57,7 @@ int main(int argc, char *argv[]){
     Uint8 *video_buf = NULL;
 
     const char *path = "1.yuv";
+    int64_t start;
 
     const unsigned int yuv_frame_len = video_width * video_height * 12 / 8;
     unsigned int tmp_yuv_frame_len = yuv_frame_len;
@@ -63,6 +66,8 @@ int main(int argc, char *argv[]){
         tmp_yuv_frame_len = (yuv_frame_len & 0xFFF0) + 0x10;
     }
 
+    ms_init(argv[0]);
+
     SDL_Init(SDL_INIT_VIDEO);
     pWindow = SDL_CreateWindow("YUV Player", 
                                 SDL_WINDOWPOS_UNDEFINED, 
@@ -118,6 +123,7 @@ int main(int argc, char *argv[]){
     do{
         SDL_WaitEvent(&event);
         if(event.type == REFRESH_EVENT){
+            start = ms_timer_start();
             SDL_UpdateTexture(pTexture,
                                 NULL,
                                 video_pos,
@@ -131,7 +137,10 @@ int main(int argc, char *argv[]){
 
             SDL_RenderCopy(pRenderer, pTexture, NULL, &rect);
             SDL_RenderPresent(pRenderer);
+            ms_timer_stop(MS_RENDER, start);
+            ms_count(MS_FRAMES, 1);
 
+            start = ms_timer_start();
             if((video_buff_len = fread(video_buf,
                                         1,
                                         yuv_frame_len,
@@ -139,6 +148,9 @@ int main(int argc, char *argv[]){
                 //a mutex should be added here.
                 thread_exit = 1;
             }
+            ms_timer_stop(MS_IO, start);
+            ms_count(MS_BYTES_IN, video_buff_len);
+            ms_tick();
         }else if(event.type == SDL_WINDOWEVENT){
             SDL_GetWindowSize(pWindow, &w_width, &w_height);
         }else if(event.type == SDL_QUIT){
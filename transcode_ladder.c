@@ -0,0 +1,871 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libavutil/buffer.h>
+#include <libavutil/cpu.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/log.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+
+#include "transcode_ladder.h"
+#include "media_stats.h"
+
+//frames queued per rendition, the decoder waits when the slowest one is full
+#define TL_QUEUE_DEPTH 8
+#define TL_PIX_FMT AV_PIX_FMT_YUV420P
+
+enum TlSlotState {
+    TL_SLOT_EMPTY,
+    //shared source frame waiting for a scale worker
+    TL_SLOT_PENDING,
+    //scaled frame or audio packet waiting for the encoder thread
+    TL_SLOT_READY,
+};
+
+typedef struct TlSlot {
+    enum TlSlotState state;
+    int audio;
+    AVFrame *src;
+    AVFrame *dst;
+    AVPacket *pkt;
+} TlSlot;
+
+typedef struct TlRendition {
+    TranscodeLadder *ladder;
+    int index;
+    TranscodeRendition spec;
+    char dst[1024];
+
+    AVCodecContext *pEncoderContext;
+    AVFormatContext *pOutputFormatContext;
+    AVStream *video_stream;
+    AVStream *audio_stream;
+    int header_written;
+    AVPacket *pPacket;
+
+    //scaled pictures come from here and go back once the encoder lets go
+    AVBufferPool *pool;
+
+    //ring of queued items, consumed strictly in submit order
+    TlSlot slots[TL_QUEUE_DEPTH];
+    int64_t nb_submitted;
+    int64_t nb_consumed;
+
+    pthread_t thread;
+    int thread_started;
+    int ret;
+
+    int64_t nb_frames;
+    int64_t nb_bytes;
+    int64_t encode_ns;
+    int64_t done_ns;
+} TlRendition;
+
+typedef struct TlJob {
+    TlRendition *rendition;
+    TlSlot *slot;
+} TlJob;
+
+//sws contexts are not shareable, each worker keeps one per rendition
+typedef struct TlWorker {
+    TranscodeLadder *ladder;
+    pthread_t thread;
+    struct SwsContext *pSwsContexts[TL_MAX_RENDITIONS];
+} TlWorker;
+
+struct TranscodeLadder {
+    TranscodeLadderOptions opts;
+    TlRendition renditions[TL_MAX_RENDITIONS];
+    int nb_renditions;
+
+    int video_index;
+    int audio_index;
+    AVStream *in_video;
+    AVStream *in_audio;
+    AVCodecContext *pDecoderContext;
+    AVFrame *pFrame;
+
+    TlWorker *workers;
+    int nb_workers;
+    int nb_workers_started;
+
+    //a slot is pending at most once, so this can never overflow
+    TlJob jobs[TL_MAX_RENDITIONS * TL_QUEUE_DEPTH];
+    int job_head;
+    int nb_jobs;
+
+    //one lock for all queues, the work done per item dwarfs it
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond;
+    pthread_cond_t slot_cond;
+    int eof;
+
+    int64_t start_ns;
+    int64_t nb_decoded;
+};
+
+int tl_add_rendition(TranscodeLadderOptions *opts, const char *spec){
+    TranscodeRendition *rendition;
+    char *end;
+
+    if(opts->nb_renditions == TL_MAX_RENDITIONS){
+        av_log(NULL, AV_LOG_ERROR, "at most %d renditions\n", TL_MAX_RENDITIONS);
+        return AVERROR(EINVAL);
+    }
+
+    rendition = &opts->renditions[opts->nb_renditions];
+    rendition->width = strtol(spec, &end, 10);
+    if(*end == 'x'){
+        rendition->height = strtol(end + 1, &end, 10);
+    }
+    rendition->bit_rate = 0;
+
+    if(*end == ':'){
+        double bit_rate = strtod(end + 1, &end);
+
+        if(*end == 'k' || *end == 'K'){
+            bit_rate *= 1000;
+            end++;
+        }else if(*end == 'M'){
+            bit_rate *= 1000000;
+            end++;
+        }
+        rendition->bit_rate = bit_rate;
+    }
+
+    //4:2:0 needs even sizes
+    if(*end || rendition->width <= 0 || rendition->height <= 0 ||
+       (rendition->width | rendition->height) & 1 || rendition->bit_rate < 0){
+        av_log(NULL, AV_LOG_ERROR, "bad rendition %s, expected WxH[:bitrate] with even sizes\n", spec);
+        return AVERROR(EINVAL);
+    }
+
+    opts->nb_renditions++;
+
+    return 0;
+}
+
+static int scale_frame(TlWorker *worker, TlRendition *rendition, TlSlot *slot){
+    AVFrame *src = slot->src;
+    AVFrame *dst = slot->dst;
+    int width = rendition->spec.width;
+    int height = rendition->spec.height;
+    int64_t start = ms_timer_start();
+    int ret = 0;
+
+    //a rendition at the source size takes the decoded frame as it is
+    if(src->width == width && src->height == height && src->format == TL_PIX_FMT){
+        ret = av_frame_ref(dst, src);
+        goto end;
+    }
+
+    worker->pSwsContexts[rendition->index] = sws_getCachedContext(worker->pSwsContexts[rendition->index],
+                                                                  src->width, src->height, src->format,
+                                                                  width, height, TL_PIX_FMT,
+                                                                  SWS_BILINEAR, NULL, NULL, NULL);
+    if(!worker->pSwsContexts[rendition->index]){
+        ret = AVERROR(EINVAL);
+        goto end;
+    }
+
+    dst->buf[0] = av_buffer_pool_get(rendition->pool);
+    if(!dst->buf[0]){
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    av_image_fill_arrays(dst->data, dst->linesize, dst->buf[0]->data, TL_PIX_FMT, width, height, 32);
+    dst->width = width;
+    dst->height = height;
+    dst->format = TL_PIX_FMT;
+
+    sws_scale(worker->pSwsContexts[rendition->index], (const uint8_t * const *)src->data, src->linesize,
+              0, src->height, dst->data, dst->linesize);
+
+    ret = av_frame_copy_props(dst, src);
+
+end:
+    //the decoder's frame type must not force keyframes on the encoder
+    dst->pict_type = AV_PICTURE_TYPE_NONE;
+    //the decoded picture goes back to the decoder as soon as possible
+    av_frame_unref(src);
+    ms_timer_stop(MS_SCALE, start);
+
+    return ret;
+}
+
+static void *worker_thread(void *arg){
+    TlWorker *worker = arg;
+    TranscodeLadder *ladder = worker->ladder;
+
+    pthread_mutex_lock(&ladder->lock);
+
+    while(1){
+        TlJob job;
+        int ret;
+
+        while(!ladder->nb_jobs && !ladder->eof){
+            pthread_cond_wait(&ladder->job_cond, &ladder->lock);
+        }
+
+        //eof only stops the pool once every queued job is done
+        if(!ladder->nb_jobs){
+            break;
+        }
+
+        job = ladder->jobs[ladder->job_head];
+        ladder->job_head = (ladder->job_head + 1) % FF_ARRAY_ELEMS(ladder->jobs);
+        ladder->nb_jobs--;
+
+        pthread_mutex_unlock(&ladder->lock);
+        ret = scale_frame(worker, job.rendition, job.slot);
+        pthread_mutex_lock(&ladder->lock);
+
+        if(ret < 0 && job.rendition->ret >= 0){
+            av_log(NULL, AV_LOG_ERROR, "failed to scale for %s\n", job.rendition->dst);
+            job.rendition->ret = ret;
+        }
+        job.slot->state = TL_SLOT_READY;
+        pthread_cond_broadcast(&ladder->slot_cond);
+    }
+
+    pthread_mutex_unlock(&ladder->lock);
+
+    return NULL;
+}
+
+static int write_packet(TlRendition *rendition, AVPacket *pPacket){
+    int64_t start = ms_timer_start();
+    int ret;
+
+    ms_count(MS_BYTES_OUT, pPacket->size);
+
+    ret = av_interleaved_write_frame(rendition->pOutputFormatContext, pPacket);
+    ms_timer_stop(MS_WRITE_FRAME, start);
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to mux packet into %s\n", rendition->dst);
+    }
+
+    return ret;
+}
+
+//frame NULL drains the encoder
+static int encode_frame(TlRendition *rendition, AVFrame *frame){
+    AVCodecContext *pEncoderContext = rendition->pEncoderContext;
+    int64_t start = ms_now();
+    int64_t busy = 0;
+    int ret;
+
+    if(frame && frame->pts != AV_NOPTS_VALUE){
+        frame->pts = av_rescale_q(frame->pts, rendition->ladder->in_video->time_base, pEncoderContext->time_base);
+    }
+
+    ret = avcodec_send_frame(pEncoderContext, frame);
+
+    while(ret >= 0){
+        ret = avcodec_receive_packet(pEncoderContext, rendition->pPacket);
+        if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF){
+            ret = 0;
+            break;
+        }else if(ret < 0){
+            break;
+        }
+
+        busy += ms_now() - start;
+
+        rendition->nb_bytes += rendition->pPacket->size;
+        av_packet_rescale_ts(rendition->pPacket, pEncoderContext->time_base, rendition->video_stream->time_base);
+        rendition->pPacket->stream_index = rendition->video_stream->index;
+        ret = write_packet(rendition, rendition->pPacket);
+
+        start = ms_now();
+    }
+
+    busy += ms_now() - start;
+    rendition->encode_ns += busy;
+    if(ms_enabled){
+        ms_add_time(MS_ENCODE, busy);
+    }
+
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to encode for %s\n", rendition->dst);
+    }else if(frame){
+        rendition->nb_frames++;
+    }
+
+    return ret;
+}
+
+static int copy_audio(TlRendition *rendition, AVPacket *pPacket){
+    av_packet_rescale_ts(pPacket, rendition->ladder->in_audio->time_base, rendition->audio_stream->time_base);
+    pPacket->stream_index = rendition->audio_stream->index;
+    pPacket->pos = -1;
+
+    return write_packet(rendition, pPacket);
+}
+
+//the only thread touching the encoder and the muxer of its rendition
+static void *encoder_thread(void *arg){
+    TlRendition *rendition = arg;
+    TranscodeLadder *ladder = rendition->ladder;
+
+    while(1){
+        TlSlot *slot;
+        int ret = 0, failed;
+
+        pthread_mutex_lock(&ladder->lock);
+        slot = &rendition->slots[rendition->nb_consumed % TL_QUEUE_DEPTH];
+        while(slot->state != TL_SLOT_READY &&
+              !(ladder->eof && rendition->nb_consumed == rendition->nb_submitted)){
+            pthread_cond_wait(&ladder->slot_cond, &ladder->lock);
+        }
+        if(slot->state != TL_SLOT_READY){
+            pthread_mutex_unlock(&ladder->lock);
+            break;
+        }
+        failed = rendition->ret < 0;
+        pthread_mutex_unlock(&ladder->lock);
+
+        //a failed rendition keeps draining its queue so the decoder never stalls
+        if(slot->audio){
+            if(!failed){
+                ret = copy_audio(rendition, slot->pkt);
+            }
+            av_packet_unref(slot->pkt);
+        }else{
+            if(!failed){
+                ret = encode_frame(rendition, slot->dst);
+            }
+            av_frame_unref(slot->dst);
+        }
+
+        pthread_mutex_lock(&ladder->lock);
+        if(ret < 0 && rendition->ret >= 0){
+            rendition->ret = ret;
+        }
+        slot->state = TL_SLOT_EMPTY;
+        rendition->nb_consumed++;
+        pthread_cond_broadcast(&ladder->slot_cond);
+        pthread_mutex_unlock(&ladder->lock);
+    }
+
+    //nothing else touches the rendition any more
+    if(rendition->ret >= 0){
+        rendition->ret = encode_frame(rendition, NULL);
+    }
+    rendition->done_ns = ms_now();
+
+    return NULL;
+}
+
+//hand a decoded frame or an audio packet to every rendition, by reference
+static int submit(TranscodeLadder *ladder, AVFrame *frame, AVPacket *pPacket){
+    int ret = 0;
+
+    pthread_mutex_lock(&ladder->lock);
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        TlRendition *rendition = &ladder->renditions[i];
+        TlSlot *slot = &rendition->slots[rendition->nb_submitted % TL_QUEUE_DEPTH];
+
+        while(slot->state != TL_SLOT_EMPTY){
+            pthread_cond_wait(&ladder->slot_cond, &ladder->lock);
+        }
+
+        if(frame){
+            if((ret = av_frame_ref(slot->src, frame)) < 0){
+                break;
+            }
+            slot->audio = 0;
+            slot->state = TL_SLOT_PENDING;
+            ladder->jobs[(ladder->job_head + ladder->nb_jobs++) % FF_ARRAY_ELEMS(ladder->jobs)] =
+                (TlJob){ .rendition = rendition, .slot = slot };
+            pthread_cond_signal(&ladder->job_cond);
+        }else{
+            if((ret = av_packet_ref(slot->pkt, pPacket)) < 0){
+                break;
+            }
+            slot->audio = 1;
+            slot->state = TL_SLOT_READY;
+        }
+
+        rendition->nb_submitted++;
+    }
+
+    pthread_cond_broadcast(&ladder->slot_cond);
+    pthread_mutex_unlock(&ladder->lock);
+
+    return ret;
+}
+
+//pPacket NULL drains the decoder. one corrupt packet or frame is skipped,
+//anything else such as running out of memory stops every rendition
+static int decode_packet(TranscodeLadder *ladder, AVPacket *pPacket){
+    int64_t start = ms_timer_start();
+    int ret;
+
+    ret = avcodec_send_packet(ladder->pDecoderContext, pPacket);
+    if(ret == AVERROR_INVALIDDATA){
+        ms_timer_stop(MS_DECODE, start);
+        av_log(NULL, AV_LOG_WARNING, "skipping undecodable packet\n");
+        return 0;
+    }else if(ret < 0 && ret != AVERROR_EOF){
+        ms_timer_stop(MS_DECODE, start);
+        av_log(NULL, AV_LOG_ERROR, "failed to decode: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    while(1){
+        ret = avcodec_receive_frame(ladder->pDecoderContext, ladder->pFrame);
+        if(ret == AVERROR_INVALIDDATA){
+            av_log(NULL, AV_LOG_WARNING, "skipping undecodable frame\n");
+            continue;
+        }else if(ret < 0){
+            break;
+        }
+        ms_timer_stop(MS_DECODE, start);
+        ms_count(MS_FRAMES, 1);
+        ladder->nb_decoded++;
+
+        ladder->pFrame->pts = ladder->pFrame->best_effort_timestamp;
+        ret = submit(ladder, ladder->pFrame, NULL);
+        av_frame_unref(ladder->pFrame);
+        if(ret < 0){
+            return ret;
+        }
+        start = ms_timer_start();
+    }
+    //the last receive returning no frame is decode time as well
+    ms_timer_stop(MS_DECODE, start);
+
+    if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF){
+        return 0;
+    }
+
+    av_log(NULL, AV_LOG_ERROR, "failed to decode: %s\n", av_err2str(ret));
+
+    return ret;
+}
+
+static int open_decoder(TranscodeLadder *ladder){
+    AVCodecParameters *pCodecParameters = ladder->in_video->codecpar;
+    const AVCodec *pCodec = avcodec_find_decoder(pCodecParameters->codec_id);
+    int ret;
+
+    if(!pCodec){
+        av_log(NULL, AV_LOG_ERROR, "no decoder for %s\n", avcodec_get_name(pCodecParameters->codec_id));
+        return AVERROR_DECODER_NOT_FOUND;
+    }
+
+    ladder->pDecoderContext = avcodec_alloc_context3(pCodec);
+    ladder->pFrame = av_frame_alloc();
+    if(!ladder->pDecoderContext || !ladder->pFrame){
+        return AVERROR(ENOMEM);
+    }
+
+    if((ret = avcodec_parameters_to_context(ladder->pDecoderContext, pCodecParameters)) < 0){
+        return ret;
+    }
+
+    ladder->pDecoderContext->pkt_timebase = ladder->in_video->time_base;
+    ladder->pDecoderContext->thread_count = 0;
+
+    if((ret = avcodec_open2(ladder->pDecoderContext, pCodec, NULL)) < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open decoder\n");
+        return ret;
+    }
+
+    return 0;
+}
+
+static const AVCodec *find_encoder(const char *name){
+    const AVCodec *pCodec;
+
+    if(name){
+        return avcodec_find_encoder_by_name(name);
+    }
+
+    if((pCodec = avcodec_find_encoder_by_name("libx264")) ||
+       (pCodec = avcodec_find_encoder(AV_CODEC_ID_H264))){
+        return pCodec;
+    }
+
+    //always built and still playable from flv
+    return avcodec_find_encoder(AV_CODEC_ID_FLV1);
+}
+
+static int open_rendition(TranscodeLadder *ladder, TlRendition *rendition){
+    const AVCodec *pCodec = find_encoder(ladder->opts.encoder);
+    AVCodecContext *pEncoderContext;
+    AVFormatContext *pOutputFormatContext;
+    AVRational framerate = ladder->in_video->avg_frame_rate;
+    AVDictionary *options = NULL;
+    int ret, buffer_size;
+
+    if(!pCodec){
+        av_log(NULL, AV_LOG_ERROR, "encoder %s not found\n", ladder->opts.encoder ? ladder->opts.encoder : "h264");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    avformat_alloc_output_context2(&rendition->pOutputFormatContext, NULL, NULL, rendition->dst);
+    pOutputFormatContext = rendition->pOutputFormatContext;
+    if(!pOutputFormatContext){
+        av_log(NULL, AV_LOG_ERROR, "failed to allocate output context\n");
+        return AVERROR_UNKNOWN;
+    }
+
+    rendition->pEncoderContext = avcodec_alloc_context3(pCodec);
+    rendition->pPacket = av_packet_alloc();
+    pEncoderContext = rendition->pEncoderContext;
+    if(!pEncoderContext || !rendition->pPacket){
+        return AVERROR(ENOMEM);
+    }
+
+    pEncoderContext->width = rendition->spec.width;
+    pEncoderContext->height = rendition->spec.height;
+    pEncoderContext->pix_fmt = TL_PIX_FMT;
+    //mpeg4 style encoders such as flv1 reject a time base denominator
+    //above 65535, milliseconds are as fine as flv timestamps anyway
+    pEncoderContext->time_base = ladder->in_video->time_base;
+    if(pEncoderContext->time_base.den > 65535){
+        pEncoderContext->time_base = (AVRational){1, 1000};
+    }
+    pEncoderContext->bit_rate = rendition->spec.bit_rate;
+    //keyframes every two seconds so every rendition can be switched to
+    if(framerate.num > 0 && framerate.den > 0){
+        pEncoderContext->framerate = framerate;
+        pEncoderContext->gop_size = 2 * framerate.num / framerate.den;
+    }
+    //the encoders share the machine
+    pEncoderContext->thread_count = FFMAX(1, av_cpu_count() / ladder->nb_renditions);
+
+    if(pOutputFormatContext->oformat->flags & AVFMT_GLOBALHEADER){
+        pEncoderContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if(ladder->opts.preset){
+        av_dict_set(&options, "preset", ladder->opts.preset, 0);
+    }
+    ret = avcodec_open2(pEncoderContext, pCodec, &options);
+    av_dict_free(&options);
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to open %s for %s\n", pCodec->name, rendition->dst);
+        return ret;
+    }
+
+    rendition->video_stream = avformat_new_stream(pOutputFormatContext, NULL);
+    if(!rendition->video_stream){
+        return AVERROR(ENOMEM);
+    }
+    if((ret = avcodec_parameters_from_context(rendition->video_stream->codecpar, pEncoderContext)) < 0){
+        return ret;
+    }
+    rendition->video_stream->time_base = pEncoderContext->time_base;
+
+    if(ladder->in_audio){
+        rendition->audio_stream = avformat_new_stream(pOutputFormatContext, NULL);
+        if(!rendition->audio_stream){
+            return AVERROR(ENOMEM);
+        }
+        if((ret = avcodec_parameters_copy(rendition->audio_stream->codecpar, ladder->in_audio->codecpar)) < 0){
+            return ret;
+        }
+        rendition->audio_stream->codecpar->codec_tag = 0;
+    }
+
+    av_dump_format(pOutputFormatContext, rendition->index, rendition->dst, 1);
+
+    if(!(pOutputFormatContext->oformat->flags & AVFMT_NOFILE)){
+        ret = avio_open(&pOutputFormatContext->pb, rendition->dst, AVIO_FLAG_WRITE);
+        if(ret < 0){
+            av_log(NULL, AV_LOG_ERROR, "failed to open output file %s\n", rendition->dst);
+            return ret;
+        }
+    }
+
+    ret = avformat_write_header(pOutputFormatContext, NULL);
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "failed to write header\n");
+        return ret;
+    }
+    rendition->header_written = 1;
+
+    buffer_size = av_image_get_buffer_size(TL_PIX_FMT, rendition->spec.width, rendition->spec.height, 32);
+    rendition->pool = av_buffer_pool_init(buffer_size, NULL);
+    if(!rendition->pool){
+        return AVERROR(ENOMEM);
+    }
+
+    for(int i = 0; i < TL_QUEUE_DEPTH; i++){
+        TlSlot *slot = &rendition->slots[i];
+
+        slot->src = av_frame_alloc();
+        slot->dst = av_frame_alloc();
+        slot->pkt = av_packet_alloc();
+        if(!slot->src || !slot->dst || !slot->pkt){
+            return AVERROR(ENOMEM);
+        }
+        ms_count(MS_ALLOCS, 3);
+    }
+
+    return 0;
+}
+
+static int tl_sink_open(void *opaque, MediaInput *input){
+    TranscodeLadder *ladder = opaque;
+    int ret;
+
+    ladder->video_index = mp_find_stream(input, AVMEDIA_TYPE_VIDEO);
+    if(ladder->video_index < 0){
+        av_log(NULL, AV_LOG_ERROR, "no video stream to transcode\n");
+        return ladder->video_index;
+    }
+    ladder->in_video = input->pFormatContext->streams[ladder->video_index];
+
+    ladder->audio_index = mp_find_stream(input, AVMEDIA_TYPE_AUDIO);
+    if(ladder->audio_index >= 0){
+        ladder->in_audio = input->pFormatContext->streams[ladder->audio_index];
+    }
+
+    if((ret = open_decoder(ladder)) < 0){
+        return ret;
+    }
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        if((ret = open_rendition(ladder, &ladder->renditions[i])) < 0){
+            return ret;
+        }
+    }
+
+    ladder->workers = av_calloc(ladder->nb_workers, sizeof(*ladder->workers));
+    if(!ladder->workers){
+        return AVERROR(ENOMEM);
+    }
+
+    for(int i = 0; i < ladder->nb_workers; i++){
+        ladder->workers[i].ladder = ladder;
+        if(pthread_create(&ladder->workers[i].thread, NULL, worker_thread, &ladder->workers[i])){
+            break;
+        }
+        ladder->nb_workers_started++;
+    }
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        TlRendition *rendition = &ladder->renditions[i];
+
+        if(pthread_create(&rendition->thread, NULL, encoder_thread, rendition)){
+            return AVERROR(EAGAIN);
+        }
+        rendition->thread_started = 1;
+    }
+
+    if(!ladder->nb_workers_started){
+        return AVERROR(EAGAIN);
+    }
+
+    ladder->start_ns = ms_now();
+
+    return 0;
+}
+
+static int tl_sink_write(void *opaque, MediaInput *input, AVPacket *pPacket){
+    TranscodeLadder *ladder = opaque;
+
+    if(pPacket->stream_index == ladder->video_index){
+        return decode_packet(ladder, pPacket);
+    }
+
+    if(ladder->in_audio && pPacket->stream_index == ladder->audio_index){
+        return submit(ladder, NULL, pPacket);
+    }
+
+    return 0;
+}
+
+static int tl_sink_close(void *opaque, MediaInput *input){
+    TranscodeLadder *ladder = opaque;
+    int ret = 0, err;
+
+    //threads only run when open went all the way through
+    if(ladder->nb_workers_started && ladder->renditions[ladder->nb_renditions - 1].thread_started){
+        ret = decode_packet(ladder, NULL);
+    }
+
+    pthread_mutex_lock(&ladder->lock);
+    ladder->eof = 1;
+    pthread_cond_broadcast(&ladder->job_cond);
+    pthread_cond_broadcast(&ladder->slot_cond);
+    pthread_mutex_unlock(&ladder->lock);
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        if(ladder->renditions[i].thread_started){
+            pthread_join(ladder->renditions[i].thread, NULL);
+            ladder->renditions[i].thread_started = 0;
+        }
+    }
+
+    for(int i = 0; i < ladder->nb_workers_started; i++){
+        pthread_join(ladder->workers[i].thread, NULL);
+    }
+    ladder->nb_workers_started = 0;
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        TlRendition *rendition = &ladder->renditions[i];
+        AVFormatContext *pOutputFormatContext = rendition->pOutputFormatContext;
+
+        if(!pOutputFormatContext){
+            continue;
+        }
+
+        if(rendition->header_written){
+            err = av_write_trailer(pOutputFormatContext);
+            if(rendition->ret >= 0){
+                rendition->ret = err;
+            }
+        }
+
+        if(!(pOutputFormatContext->oformat->flags & AVFMT_NOFILE)){
+            avio_closep(&pOutputFormatContext->pb);
+        }
+
+        if(ret >= 0 && rendition->ret < 0){
+            ret = rendition->ret;
+        }
+    }
+
+    return ret;
+}
+
+void tl_sink(TranscodeLadder *ladder, MediaSink *sink){
+    sink->opaque = ladder;
+    sink->open = tl_sink_open;
+    sink->write_packet = tl_sink_write;
+    sink->close = tl_sink_close;
+}
+
+int tl_open(TranscodeLadder **pladder, const TranscodeLadderOptions *opts){
+    TranscodeLadder *ladder;
+    char name[sizeof(((TlRendition *)0)->dst)];
+    int ret = 0;
+
+    *pladder = NULL;
+
+    if(opts->nb_renditions < 1 || !opts->dst){
+        return AVERROR(EINVAL);
+    }
+
+    //every rendition needs its own file
+    for(int i = 0; i < opts->nb_renditions; i++){
+        for(int j = 0; j < i; j++){
+            if(opts->renditions[i].height == opts->renditions[j].height){
+                av_log(NULL, AV_LOG_ERROR, "renditions need distinct heights\n");
+                return AVERROR(EINVAL);
+            }
+        }
+    }
+
+    for(int i = 0; i < opts->nb_renditions; i++){
+        if((ret = mp_format_name(name, sizeof(name), opts->dst, opts->renditions[i].height)) < 0){
+            return ret;
+        }
+    }
+    if(!ret && opts->nb_renditions > 1){
+        av_log(NULL, AV_LOG_ERROR, "output name needs a %%d for the rendition height\n");
+        return AVERROR(EINVAL);
+    }
+
+    ladder = av_mallocz(sizeof(*ladder));
+    if(!ladder){
+        return AVERROR(ENOMEM);
+    }
+
+    ladder->opts = *opts;
+    ladder->nb_renditions = opts->nb_renditions;
+    ladder->nb_workers = opts->nb_workers > 0 ? opts->nb_workers : opts->nb_renditions;
+    ladder->video_index = ladder->audio_index = -1;
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        TlRendition *rendition = &ladder->renditions[i];
+
+        rendition->ladder = ladder;
+        rendition->index = i;
+        rendition->spec = opts->renditions[i];
+        //every name was checked above
+        mp_format_name(rendition->dst, sizeof(rendition->dst), opts->dst, rendition->spec.height);
+    }
+
+    pthread_mutex_init(&ladder->lock, NULL);
+    pthread_cond_init(&ladder->job_cond, NULL);
+    pthread_cond_init(&ladder->slot_cond, NULL);
+
+    *pladder = ladder;
+
+    return 0;
+}
+
+int tl_close(TranscodeLadder **pladder){
+    TranscodeLadder *ladder = *pladder;
+    int ret = 0;
+
+    if(!ladder){
+        return 0;
+    }
+
+    if(ladder->nb_decoded){
+        av_log(NULL, AV_LOG_INFO, "decoded %"PRId64" frames once for %d renditions\n",
+               ladder->nb_decoded, ladder->nb_renditions);
+    }
+
+    for(int i = 0; i < ladder->nb_renditions; i++){
+        TlRendition *rendition = &ladder->renditions[i];
+
+        //wall clock fps and what the encoder alone would manage
+        if(rendition->nb_frames && rendition->done_ns > ladder->start_ns){
+            av_log(NULL, AV_LOG_INFO, "%s: %dx%d, %"PRId64" frames, %.1f fps, encoder %.1f fps, %.1f MB\n",
+                   rendition->dst, rendition->spec.width, rendition->spec.height, rendition->nb_frames,
+                   rendition->nb_frames * 1e9 / (rendition->done_ns - ladder->start_ns),
+                   rendition->encode_ns ? rendition->nb_frames * 1e9 / rendition->encode_ns : 0.0,
+                   rendition->nb_bytes / 1e6);
+        }
+
+        if(ret >= 0 && rendition->ret < 0){
+            ret = rendition->ret;
+        }
+
+        for(int j = 0; j < TL_QUEUE_DEPTH; j++){
+            av_frame_free(&rendition->slots[j].src);
+            av_frame_free(&rendition->slots[j].dst);
+            av_packet_free(&rendition->slots[j].pkt);
+        }
+
+        av_packet_free(&rendition->pPacket);
+        avcodec_free_context(&rendition->pEncoderContext);
+        avformat_free_context(rendition->pOutputFormatContext);
+        //frames still held by the encoder are gone, the pool frees itself last
+        av_buffer_pool_uninit(&rendition->pool);
+    }
+
+    if(ladder->workers){
+        for(int i = 0; i < ladder->nb_workers; i++){
+            for(int j = 0; j < ladder->nb_renditions; j++){
+                sws_freeContext(ladder->workers[i].pSwsContexts[j]);
+            }
+        }
+        av_freep(&ladder->workers);
+    }
+
+    av_frame_free(&ladder->pFrame);
+    avcodec_free_context(&ladder->pDecoderContext);
+
+    pthread_mutex_destroy(&ladder->lock);
+    pthread_cond_destroy(&ladder->job_cond);
+    pthread_cond_destroy(&ladder->slot_cond);
+
+    av_freep(pladder);
+
+    return ret;
+}
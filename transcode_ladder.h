@@ -0,0 +1,45 @@
+#ifndef TRANSCODE_LADDER_H
+#define TRANSCODE_LADDER_H
+
+#include <stdint.h>
+
+#include "media_pipeline.h"
+
+//decode once, encode many. every decoded video frame is shared by reference
+//with all renditions, scaled by a pool of swscale workers and encoded by one
+//thread per rendition, each into its own output. audio is stream copied into
+//every output. needs libswscale and -lpthread.
+
+#define TL_MAX_RENDITIONS 8
+
+typedef struct TranscodeRendition {
+    int width;
+    int height;
+    //0 leaves rate control to the encoder defaults
+    int64_t bit_rate;
+} TranscodeRendition;
+
+//zero fields pick the defaults: libx264 or any other h264 encoder, flv1 when
+//there is none, and one scale worker per rendition
+typedef struct TranscodeLadderOptions {
+    //output name, %d is replaced by the rendition height
+    const char *dst;
+    const char *encoder;
+    const char *preset;
+    int nb_workers;
+    TranscodeRendition renditions[TL_MAX_RENDITIONS];
+    int nb_renditions;
+} TranscodeLadderOptions;
+
+typedef struct TranscodeLadder TranscodeLadder;
+
+//parse WxH[:bitrate] such as 1280x720:2500k into the next rendition
+int tl_add_rendition(TranscodeLadderOptions *opts, const char *spec);
+
+int tl_open(TranscodeLadder **pladder, const TranscodeLadderOptions *opts);
+//sink for mp_run over all streams, it decodes the first video stream
+void tl_sink(TranscodeLadder *ladder, MediaSink *sink);
+//report per rendition fps and free everything
+int tl_close(TranscodeLadder **pladder);
+
+#endif
@@ -0,0 +1,497 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libavutil/log.h>
+#include <libavutil/intreadwrite.h>
+#include <libavformat/avformat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+#include "media_pipeline.h"
+#include "media_stats.h"
+
+//demux a source and the output made from it (mp4_to_flv, extract_video,
+//extract_audio) in lockstep and compare every packet of the mapped streams.
+//payloads are hashed with crc32c in place, framing is normalized first:
+//h264 nal units are hashed without length prefix or start code and without
+//the sps/pps/aud the annex-b writer inserts, adts headers are skipped
+
+typedef struct PacketRecord {
+    uint32_t hash;
+    int size;
+    int64_t pts;
+    int64_t dts;
+} PacketRecord;
+
+//records one side has read and the other has not reached yet
+typedef struct RecordQueue {
+    PacketRecord *records;
+    int head;
+    int len;
+    int capacity;
+} RecordQueue;
+
+typedef struct StreamPair {
+    int src_index;
+    int dst_index;
+    RecordQueue queues[2];
+    int64_t first_ts[2];
+    int64_t nb_packets;
+    int64_t nb_bytes;
+    int64_t hash_mismatches;
+    int64_t ts_mismatches;
+} StreamPair;
+
+typedef struct VerifySide {
+    MediaInput input;
+    int *pair_of_stream;
+    int h264_avcc;
+    int nal_length_size;
+    int eof;
+} VerifySide;
+
+static uint32_t crc32c_table[256];
+static uint32_t (*crc32c_update)(uint32_t crc, const uint8_t *data, size_t size);
+
+static uint32_t crc32c_update_c(uint32_t crc, const uint8_t *data, size_t size){
+    while(size--){
+        crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_sse42(uint32_t crc, const uint8_t *data, size_t size){
+    uint64_t crc64 = crc;
+
+    while(size && ((uintptr_t)data & 7)){
+        crc64 = _mm_crc32_u8(crc64, *data++);
+        size--;
+    }
+
+    //three independent lanes would go faster still, one is already past disk speed
+    for(; size >= 8; size -= 8, data += 8){
+        crc64 = _mm_crc32_u64(crc64, *(const uint64_t *)data);
+    }
+
+    while(size--){
+        crc64 = _mm_crc32_u8(crc64, *data++);
+    }
+
+    return crc64;
+}
+#endif
+
+static void crc32c_init(void){
+    for(uint32_t i = 0; i < 256; i++){
+        uint32_t crc = i;
+
+        for(int j = 0; j < 8; j++){
+            crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+        }
+        crc32c_table[i] = crc;
+    }
+
+    crc32c_update = crc32c_update_c;
+
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("sse4.2")){
+        crc32c_update = crc32c_update_sse42;
+    }
+#endif
+}
+
+static int queue_push(RecordQueue *queue, const PacketRecord *record){
+    if(queue->len == queue->capacity){
+        int capacity = queue->capacity ? queue->capacity * 2 : 64;
+        PacketRecord *records = av_malloc_array(capacity, sizeof(*records));
+
+        if(!records){
+            return AVERROR(ENOMEM);
+        }
+
+        //unwrap the ring into the new buffer
+        for(int i = 0; i < queue->len; i++){
+            records[i] = queue->records[(queue->head + i) % queue->capacity];
+        }
+
+        av_free(queue->records);
+        queue->records = records;
+        queue->capacity = capacity;
+        queue->head = 0;
+    }
+
+    queue->records[(queue->head + queue->len) % queue->capacity] = *record;
+    queue->len++;
+
+    return 0;
+}
+
+static PacketRecord *queue_pop(RecordQueue *queue){
+    PacketRecord *record = &queue->records[queue->head];
+
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->len--;
+
+    return record;
+}
+
+//trailing zero bytes may belong to the next start code, hash both sides without them
+static uint32_t hash_nal(uint32_t crc, const uint8_t *nal, const uint8_t *end, int *size){
+    int type;
+
+    while(end > nal && !end[-1]){
+        end--;
+    }
+
+    if(end <= nal){
+        return crc;
+    }
+
+    type = nal[0] & 0x1f;
+    if(type == 7 || type == 8 || type == 9){
+        return crc;
+    }
+
+    *size += end - nal;
+
+    return crc32c_update(crc, nal, end - nal);
+}
+
+static uint32_t hash_h264_annexb(const uint8_t *buf, const uint8_t *end, int *size){
+    const uint8_t *nal = NULL;
+    uint32_t crc = ~0u;
+
+    for(const uint8_t *p = buf; p + 3 <= end; p++){
+        if(p[0] || p[1] || p[2] != 1){
+            continue;
+        }
+
+        if(nal){
+            crc = hash_nal(crc, nal, p, size);
+        }
+
+        p += 2;
+        nal = p + 1;
+    }
+
+    if(nal){
+        crc = hash_nal(crc, nal, end, size);
+    }
+
+    return ~crc;
+}
+
+static uint32_t hash_h264_avcc(const uint8_t *buf, const uint8_t *end, int length_size, int *size){
+    uint32_t crc = ~0u;
+
+    while(end - buf > length_size){
+        uint32_t nal_size = 0;
+
+        for(int i = 0; i < length_size; i++){
+            nal_size = (nal_size << 8) | buf[i];
+        }
+        buf += length_size;
+
+        if(nal_size > end - buf){
+            nal_size = end - buf;
+        }
+
+        crc = hash_nal(crc, buf, buf + nal_size, size);
+        buf += nal_size;
+    }
+
+    return ~crc;
+}
+
+static uint32_t hash_packet(const VerifySide *side, const AVCodecParameters *par, const AVPacket *pkt, int *size){
+    const uint8_t *data = pkt->data;
+    const uint8_t *end = pkt->data + pkt->size;
+
+    *size = 0;
+
+    if(par->codec_id == AV_CODEC_ID_H264){
+        if(side->h264_avcc){
+            return hash_h264_avcc(data, end, side->nal_length_size, size);
+        }
+        return hash_h264_annexb(data, end, size);
+    }
+
+    //an adts header whose frame length matches the packet is framing, not payload
+    if(par->codec_id == AV_CODEC_ID_AAC && pkt->size >= 7 &&
+       data[0] == 0xff && (data[1] & 0xf6) == 0xf0 &&
+       (((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5)) == pkt->size){
+        data += (data[1] & 0x01) ? 7 : 9;
+    }
+
+    *size = end - data;
+
+    return ~crc32c_update(~0u, data, end - data);
+}
+
+static int open_side(VerifySide *side, const char *url){
+    MediaProbePolicy policy = { .quiet = 1 };
+    AVFormatContext *pFormatContext;
+    int ret;
+
+    ret = mp_open_input(&side->input, url, &policy);
+    if(ret < 0){
+        return ret;
+    }
+
+    pFormatContext = side->input.pFormatContext;
+    side->pair_of_stream = av_malloc_array(pFormatContext->nb_streams, sizeof(*side->pair_of_stream));
+    if(!side->pair_of_stream){
+        return AVERROR(ENOMEM);
+    }
+
+    //length prefixed nal units come with avcc extradata, raw .h264 has start codes
+    side->nal_length_size = 4;
+
+    for(int i = 0; i < pFormatContext->nb_streams; i++){
+        AVCodecParameters *par = pFormatContext->streams[i]->codecpar;
+
+        side->pair_of_stream[i] = -1;
+        pFormatContext->streams[i]->discard = AVDISCARD_ALL;
+
+        if(par->codec_id == AV_CODEC_ID_H264 && par->extradata_size >= 5 && par->extradata[0] == 1){
+            side->h264_avcc = 1;
+            side->nal_length_size = (par->extradata[4] & 0x3) + 1;
+        }
+    }
+
+    return 0;
+}
+
+//the nth output stream of a type was made from the nth source stream of that type
+static int map_streams(VerifySide *src, VerifySide *dst, StreamPair *pairs){
+    AVFormatContext *pSrc = src->input.pFormatContext;
+    AVFormatContext *pDst = dst->input.pFormatContext;
+    int nb_pairs = 0;
+
+    for(int j = 0; j < pDst->nb_streams; j++){
+        enum AVMediaType type = pDst->streams[j]->codecpar->codec_type;
+        int nth = 0;
+
+        for(int k = 0; k < j; k++){
+            nth += pDst->streams[k]->codecpar->codec_type == type;
+        }
+
+        for(int i = 0; i < pSrc->nb_streams; i++){
+            if(pSrc->streams[i]->codecpar->codec_type != type || nth--){
+                continue;
+            }
+
+            if(pSrc->streams[i]->codecpar->codec_id != pDst->streams[j]->codecpar->codec_id){
+                av_log(NULL, AV_LOG_ERROR, "stream %d: codec %s in source, %s in output\n", j,
+                       avcodec_get_name(pSrc->streams[i]->codecpar->codec_id),
+                       avcodec_get_name(pDst->streams[j]->codecpar->codec_id));
+                return AVERROR_INVALIDDATA;
+            }
+
+            pairs[nb_pairs].src_index = i;
+            pairs[nb_pairs].dst_index = j;
+            pairs[nb_pairs].first_ts[0] = pairs[nb_pairs].first_ts[1] = AV_NOPTS_VALUE;
+            src->pair_of_stream[i] = nb_pairs;
+            dst->pair_of_stream[j] = nb_pairs;
+            pSrc->streams[i]->discard = AVDISCARD_DEFAULT;
+            pDst->streams[j]->discard = AVDISCARD_DEFAULT;
+            nb_pairs++;
+            break;
+        }
+    }
+
+    return nb_pairs;
+}
+
+//timestamps are compared relative to each stream's first one, in microseconds,
+//with one tick of the coarser time base as tolerance
+static int ts_equal(int64_t a, AVRational tb_a, int64_t b, AVRational tb_b){
+    int64_t tolerance;
+
+    if(a == AV_NOPTS_VALUE || b == AV_NOPTS_VALUE){
+        return a == b;
+    }
+
+    tolerance = FFMAX(av_rescale_q(1, tb_a, AV_TIME_BASE_Q), av_rescale_q(1, tb_b, AV_TIME_BASE_Q));
+
+    return llabs(av_rescale_q(a, tb_a, AV_TIME_BASE_Q) - av_rescale_q(b, tb_b, AV_TIME_BASE_Q)) <= tolerance;
+}
+
+static void compare(StreamPair *pair, VerifySide *sides, int check_ts){
+    AVRational tb_src = sides[0].input.pFormatContext->streams[pair->src_index]->time_base;
+    AVRational tb_dst = sides[1].input.pFormatContext->streams[pair->dst_index]->time_base;
+
+    while(pair->queues[0].len && pair->queues[1].len){
+        PacketRecord *a = queue_pop(&pair->queues[0]);
+        PacketRecord *b = queue_pop(&pair->queues[1]);
+
+        if(a->hash != b->hash || a->size != b->size){
+            if(!pair->hash_mismatches++){
+                av_log(NULL, AV_LOG_ERROR, "stream %d: payload differs at packet %"PRId64"\n",
+                       pair->dst_index, pair->nb_packets);
+            }
+        }else if(check_ts && (!ts_equal(a->pts, tb_src, b->pts, tb_dst) ||
+                              !ts_equal(a->dts, tb_src, b->dts, tb_dst))){
+            if(!pair->ts_mismatches++){
+                av_log(NULL, AV_LOG_ERROR, "stream %d: timestamps differ at packet %"PRId64"\n",
+                       pair->dst_index, pair->nb_packets);
+            }
+        }
+
+        pair->nb_packets++;
+        pair->nb_bytes += a->size;
+    }
+}
+
+//read one packet of a mapped stream from one side and queue its record
+static int read_side(VerifySide *sides, int side_index, StreamPair *pairs, AVPacket *pkt, int check_ts){
+    VerifySide *side = &sides[side_index];
+    AVFormatContext *pFormatContext = side->input.pFormatContext;
+    int64_t start = ms_timer_start();
+    PacketRecord record;
+    StreamPair *pair;
+    int64_t *first;
+    int ret;
+
+    ret = av_read_frame(pFormatContext, pkt);
+    ms_timer_stop(MS_READ_FRAME, start);
+    if(ret < 0){
+        side->eof = 1;
+        return ret == AVERROR_EOF ? 0 : ret;
+    }
+
+    if(side->pair_of_stream[pkt->stream_index] < 0){
+        av_packet_unref(pkt);
+        return 0;
+    }
+
+    ms_count(MS_PACKETS, 1);
+    ms_count(MS_BYTES_IN, pkt->size);
+
+    pair = &pairs[side->pair_of_stream[pkt->stream_index]];
+    first = &pair->first_ts[side_index];
+
+    record.hash = hash_packet(side, pFormatContext->streams[pkt->stream_index]->codecpar, pkt, &record.size);
+    if(*first == AV_NOPTS_VALUE){
+        *first = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    }
+    record.pts = (pkt->pts == AV_NOPTS_VALUE || *first == AV_NOPTS_VALUE) ? pkt->pts : pkt->pts - *first;
+    record.dts = (pkt->dts == AV_NOPTS_VALUE || *first == AV_NOPTS_VALUE) ? pkt->dts : pkt->dts - *first;
+    av_packet_unref(pkt);
+
+    ret = queue_push(&pair->queues[side_index], &record);
+    if(ret >= 0){
+        compare(pair, sides, check_ts);
+    }
+
+    return ret;
+}
+
+int main(int argc, char *argv[]){
+    int ret = 0, opt, nb_pairs = 0, failed = 0;
+    int check_ts = 1;
+
+    VerifySide sides[2] = { 0 };
+    StreamPair *pairs = NULL;
+    AVPacket *pkt = NULL;
+
+    av_log_set_level(AV_LOG_INFO);
+    ms_init(argv[0]);
+
+    //-T skips the timestamp check, raw elementary stream outputs have none
+    while((opt = getopt(argc, argv, "T")) != -1){
+        if(opt == 'T'){
+            check_ts = 0;
+        }else{
+            return -1;
+        }
+    }
+
+    if(argc - optind < 2){
+        av_log(NULL, AV_LOG_ERROR,
+        "Please input source media file url and remuxed output file url\n");
+        return -1;
+    }
+
+    crc32c_init();
+
+    if((ret = open_side(&sides[0], argv[optind])) < 0 ||
+       (ret = open_side(&sides[1], argv[optind + 1])) < 0){
+        goto end;
+    }
+
+    if(sides[1].input.pFormatContext->iformat->flags & AVFMT_NOTIMESTAMPS){
+        check_ts = 0;
+    }
+
+    pairs = av_calloc(sides[1].input.pFormatContext->nb_streams, sizeof(*pairs));
+    if(!pairs){
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    nb_pairs = ret = map_streams(&sides[0], &sides[1], pairs);
+    if(ret <= 0){
+        av_log(NULL, AV_LOG_ERROR, "no output stream matches a source stream\n");
+        ret = ret < 0 ? ret : AVERROR_STREAM_NOT_FOUND;
+        goto end;
+    }
+
+    pkt = mp_packet_pool_get(&sides[0].input.pool);
+
+    //alternate so neither queue grows further than the interleaving skew
+    while(!sides[0].eof || !sides[1].eof){
+        for(int i = 0; i < 2; i++){
+            if(!sides[i].eof && (ret = read_side(sides, i, pairs, pkt, check_ts)) < 0){
+                goto end;
+            }
+        }
+        ms_tick();
+    }
+
+    for(int i = 0; i < nb_pairs; i++){
+        StreamPair *pair = &pairs[i];
+        int64_t missing = pair->queues[0].len - pair->queues[1].len;
+
+        av_log(NULL, AV_LOG_INFO,
+               "stream %d: %"PRId64" packets, %"PRId64" bytes compared, %"PRId64" payload and %"PRId64" timestamp mismatches",
+               pair->dst_index, pair->nb_packets, pair->nb_bytes, pair->hash_mismatches, pair->ts_mismatches);
+        if(missing){
+            av_log(NULL, AV_LOG_INFO, ", %"PRId64" packets %s\n", (int64_t)llabs(missing), missing > 0 ? "missing from output" : "extra in output");
+        }else{
+            av_log(NULL, AV_LOG_INFO, "\n");
+        }
+
+        failed |= missing || pair->hash_mismatches || pair->ts_mismatches;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "%s\n", failed ? "verify FAILED" : "verify OK");
+
+end:
+    mp_packet_pool_put(&sides[0].input.pool, pkt);
+
+    for(int i = 0; i < 2; i++){
+        mp_close_input(&sides[i].input);
+        av_freep(&sides[i].pair_of_stream);
+    }
+
+    for(int i = 0; i < nb_pairs; i++){
+        av_freep(&pairs[i].queues[0].records);
+        av_freep(&pairs[i].queues[1].records);
+    }
+    av_freep(&pairs);
+
+    if(ret < 0){
+        av_log(NULL, AV_LOG_ERROR, "verify error: %s\n", av_err2str(ret));
+        return -1;
+    }
+
+    return failed ? 1 : 0;
+}
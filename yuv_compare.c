@@ -0,0 +1,574 @@
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "media_stats.h"
+
+//per frame, per plane psnr and ssim of two raw i420 files laid out like
+//sdlyuvplayer plays them. frames are read in batches, the next batch is read
+//while a thread pool scores the current one.
+//build: make yuv_compare
+
+#define MAX_PSNR 100.0
+#define MAX_THREADS 64
+
+typedef struct FrameScore {
+    uint64_t sse[3];
+    double ssim[3];
+} FrameScore;
+
+//block sums for ssim: sum a, sum b, sum a*a + b*b, sum a*b of one 4x4 block
+typedef int BlockSums[4];
+
+typedef struct CompareContext CompareContext;
+
+typedef struct Worker {
+    CompareContext *ctx;
+    pthread_t thread;
+    //two rows of block sums
+    BlockSums *scratch;
+} Worker;
+
+struct CompareContext {
+    int width, height;
+    int plane_width[3], plane_height[3];
+    size_t plane_offset[3];
+    size_t yuv_frame_len;
+
+    //two batches of frames from each file, one scored while the other is read
+    int batch_frames;
+    uint8_t *batch[2][2];
+    FrameScore *scores[2];
+
+    Worker workers[MAX_THREADS];
+    int nb_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    int current;
+    int nb_frames;
+    int next_frame;
+    int nb_done;
+    int quit;
+};
+
+static uint64_t (*plane_sse)(const uint8_t *a, const uint8_t *b, int stride, int width, int height);
+static void (*block_sums_row)(const uint8_t *a, const uint8_t *b, int stride, int nb_blocks, BlockSums *sums);
+
+static uint64_t plane_sse_c(const uint8_t *a, const uint8_t *b, int stride, int width, int height){
+    uint64_t sse = 0;
+
+    for(int y = 0; y < height; y++, a += stride, b += stride){
+        for(int x = 0; x < width; x++){
+            int d = a[x] - b[x];
+            sse += d * d;
+        }
+    }
+
+    return sse;
+}
+
+static void block_sums_row_c(const uint8_t *a, const uint8_t *b, int stride, int nb_blocks, BlockSums *sums){
+    for(int i = 0; i < nb_blocks; i++, a += 4, b += 4){
+        int s1 = 0, s2 = 0, ss = 0, s12 = 0;
+
+        for(int y = 0; y < 4; y++){
+            for(int x = 0; x < 4; x++){
+                int pa = a[y * stride + x];
+                int pb = b[y * stride + x];
+
+                s1 += pa;
+                s2 += pb;
+                ss += pa * pa + pb * pb;
+                s12 += pa * pb;
+            }
+        }
+
+        sums[i][0] = s1;
+        sums[i][1] = s2;
+        sums[i][2] = ss;
+        sums[i][3] = s12;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//16 pixels a step, differences squared and pair summed by pmaddwd
+static uint64_t plane_sse_sse2(const uint8_t *a, const uint8_t *b, int stride, int width, int height){
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sse = 0;
+
+    for(int y = 0; y < height; y++, a += stride, b += stride){
+        __m128i acc = _mm_setzero_si128();
+        int x = 0;
+
+        //a row sum stays far below 2^32 for any sane width
+        for(; x + 16 <= width; x += 16){
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+        sse += (uint32_t)_mm_cvtsi128_si32(acc);
+
+        for(; x < width; x++){
+            int d = a[x] - b[x];
+            sse += d * d;
+        }
+    }
+
+    return sse;
+}
+
+__attribute__((target("avx2")))
+static uint64_t plane_sse_avx2(const uint8_t *a, const uint8_t *b, int stride, int width, int height){
+    uint64_t sse = 0;
+
+    for(int y = 0; y < height; y++, a += stride, b += stride){
+        __m256i acc = _mm256_setzero_si256();
+        __m128i acc128;
+        int x = 0;
+
+        for(; x + 32 <= width; x += 32){
+            __m256i va = _mm256_loadu_si256((const __m256i *)(a + x));
+            __m256i vb = _mm256_loadu_si256((const __m256i *)(b + x));
+            __m256i lo = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(va)),
+                                          _mm256_cvtepu8_epi16(_mm256_castsi256_si128(vb)));
+            __m256i hi = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(va, 1)),
+                                          _mm256_cvtepu8_epi16(_mm256_extracti128_si256(vb, 1)));
+
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+        }
+
+        acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        acc128 = _mm_add_epi32(acc128, _mm_srli_si128(acc128, 8));
+        acc128 = _mm_add_epi32(acc128, _mm_srli_si128(acc128, 4));
+        sse += (uint32_t)_mm_cvtsi128_si32(acc128);
+
+        for(; x < width; x++){
+            int d = a[x] - b[x];
+            sse += d * d;
+        }
+    }
+
+    return sse;
+}
+
+//two 4x4 blocks a step: the four rows are summed per pixel pair with pmaddwd,
+//then neighbouring pairs are folded so lanes 0 and 2 hold the block sums
+static void block_sums_row_sse2(const uint8_t *a, const uint8_t *b, int stride, int nb_blocks, BlockSums *sums){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    int i = 0;
+
+    for(; i + 2 <= nb_blocks; i += 2, a += 8, b += 8){
+        __m128i s1 = zero, s2 = zero, ss = zero, s12 = zero;
+        int32_t out[4][4];
+
+        for(int y = 0; y < 4; y++){
+            __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + y * stride)), zero);
+            __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + y * stride)), zero);
+
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(va, ones));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(vb, ones));
+            ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(va, va), _mm_madd_epi16(vb, vb)));
+            s12 = _mm_add_epi32(s12, _mm_madd_epi16(va, vb));
+        }
+
+        _mm_storeu_si128((__m128i *)out[0], _mm_add_epi32(s1, _mm_srli_epi64(s1, 32)));
+        _mm_storeu_si128((__m128i *)out[1], _mm_add_epi32(s2, _mm_srli_epi64(s2, 32)));
+        _mm_storeu_si128((__m128i *)out[2], _mm_add_epi32(ss, _mm_srli_epi64(ss, 32)));
+        _mm_storeu_si128((__m128i *)out[3], _mm_add_epi32(s12, _mm_srli_epi64(s12, 32)));
+
+        for(int k = 0; k < 4; k++){
+            sums[i][k] = out[k][0];
+            sums[i + 1][k] = out[k][2];
+        }
+    }
+
+    if(i < nb_blocks){
+        block_sums_row_c(a, b, stride, nb_blocks - i, sums + i);
+    }
+}
+#endif
+
+static void dsp_init(void){
+    plane_sse = plane_sse_c;
+    block_sums_row = block_sums_row_c;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")){
+        plane_sse = plane_sse_sse2;
+        block_sums_row = block_sums_row_sse2;
+    }
+    if(__builtin_cpu_supports("avx2")){
+        plane_sse = plane_sse_avx2;
+    }
+#endif
+}
+
+//8x8 windows built from 2x2 neighbouring 4x4 blocks, stepping 4 pixels
+static double window_ssim(const BlockSums *top, const BlockSums *bottom){
+    const double c1 = .01 * .01 * 255 * 255 * 64;
+    const double c2 = .03 * .03 * 255 * 255 * 64 * 63;
+    double s1 = top[0][0] + top[1][0] + bottom[0][0] + bottom[1][0];
+    double s2 = top[0][1] + top[1][1] + bottom[0][1] + bottom[1][1];
+    double ss = top[0][2] + top[1][2] + bottom[0][2] + bottom[1][2];
+    double s12 = top[0][3] + top[1][3] + bottom[0][3] + bottom[1][3];
+    double vars = ss * 64 - s1 * s1 - s2 * s2;
+    double covar = s12 * 64 - s1 * s2;
+
+    return (2 * s1 * s2 + c1) * (2 * covar + c2) / ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+}
+
+//rows of block sums are kept two at a time, scratch holds both
+static double plane_ssim(const uint8_t *a, const uint8_t *b, int width, int height, BlockSums *scratch){
+    int nb_blocks = width / 4, nb_rows = height / 4;
+    BlockSums *rows[2] = { scratch, scratch + nb_blocks };
+    double total = 0;
+
+    if(nb_blocks < 2 || nb_rows < 2){
+        return 1.0;
+    }
+
+    block_sums_row(a, b, width, nb_blocks, rows[0]);
+
+    for(int y = 1; y < nb_rows; y++){
+        BlockSums *tmp;
+
+        block_sums_row(a + 4 * y * width, b + 4 * y * width, width, nb_blocks, rows[1]);
+
+        for(int x = 0; x + 1 < nb_blocks; x++){
+            total += window_ssim(rows[0] + x, rows[1] + x);
+        }
+
+        tmp = rows[0];
+        rows[0] = rows[1];
+        rows[1] = tmp;
+    }
+
+    return total / ((double)(nb_blocks - 1) * (nb_rows - 1));
+}
+
+static void score_frame(CompareContext *ctx, const uint8_t *a, const uint8_t *b, FrameScore *score, BlockSums *scratch){
+    for(int p = 0; p < 3; p++){
+        const uint8_t *pa = a + ctx->plane_offset[p];
+        const uint8_t *pb = b + ctx->plane_offset[p];
+
+        score->sse[p] = plane_sse(pa, pb, ctx->plane_width[p], ctx->plane_width[p], ctx->plane_height[p]);
+        score->ssim[p] = plane_ssim(pa, pb, ctx->plane_width[p], ctx->plane_height[p], scratch);
+    }
+}
+
+//frames of the current batch are handed out one at a time
+static void *worker_thread(void *arg){
+    Worker *worker = arg;
+    CompareContext *ctx = worker->ctx;
+
+    pthread_mutex_lock(&ctx->lock);
+    while(1){
+        int frame, current;
+
+        while(!ctx->quit && ctx->next_frame >= ctx->nb_frames){
+            pthread_cond_wait(&ctx->work_cond, &ctx->lock);
+        }
+
+        if(ctx->quit){
+            break;
+        }
+
+        frame = ctx->next_frame++;
+        current = ctx->current;
+        pthread_mutex_unlock(&ctx->lock);
+
+        score_frame(ctx,
+                    ctx->batch[current][0] + frame * ctx->yuv_frame_len,
+                    ctx->batch[current][1] + frame * ctx->yuv_frame_len,
+                    &ctx->scores[current][frame], worker->scratch);
+
+        pthread_mutex_lock(&ctx->lock);
+        if(++ctx->nb_done == ctx->nb_frames){
+            pthread_cond_signal(&ctx->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+static void dispatch(CompareContext *ctx, int current, int nb_frames){
+    pthread_mutex_lock(&ctx->lock);
+    ctx->current = current;
+    ctx->nb_frames = nb_frames;
+    ctx->next_frame = 0;
+    ctx->nb_done = 0;
+    pthread_cond_broadcast(&ctx->work_cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static void wait_done(CompareContext *ctx){
+    pthread_mutex_lock(&ctx->lock);
+    while(ctx->nb_done < ctx->nb_frames){
+        pthread_cond_wait(&ctx->done_cond, &ctx->lock);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+//whole frames read from both files, 0 at the end of the shorter one
+static int read_batch(CompareContext *ctx, FILE *fds[2], int index){
+    int64_t start = ms_timer_start();
+    size_t nb_frames[2];
+
+    for(int i = 0; i < 2; i++){
+        nb_frames[i] = fread(ctx->batch[index][i], ctx->yuv_frame_len, ctx->batch_frames, fds[i]);
+    }
+
+    ms_timer_stop(MS_IO, start);
+    ms_count(MS_BYTES_IN, (nb_frames[0] + nb_frames[1]) * ctx->yuv_frame_len);
+
+    return nb_frames[0] < nb_frames[1] ? nb_frames[0] : nb_frames[1];
+}
+
+static double psnr(uint64_t sse, double nb_pixels){
+    if(!sse){
+        return MAX_PSNR;
+    }
+
+    return fmin(MAX_PSNR, 10 * log10(255.0 * 255.0 * nb_pixels / sse));
+}
+
+//one csv line or json object, the frame field is left out when index < 0
+static void write_score(CompareContext *ctx, FILE *out, int json, int64_t index, const FrameScore *score){
+    double pixels[3], total_pixels = 0, ssim_all = 0;
+    uint64_t total_sse = 0;
+
+    for(int p = 0; p < 3; p++){
+        pixels[p] = (double)ctx->plane_width[p] * ctx->plane_height[p];
+        total_pixels += pixels[p];
+        total_sse += score->sse[p];
+        ssim_all += score->ssim[p] * pixels[p];
+    }
+    ssim_all /= total_pixels;
+
+    if(json){
+        fprintf(out, "{");
+        if(index >= 0){
+            fprintf(out, "\"frame\":%lld,", (long long)index);
+        }
+    }else if(index >= 0){
+        fprintf(out, "%lld,", (long long)index);
+    }
+
+    fprintf(out, json ? "\"psnr_y\":%.4f,\"psnr_u\":%.4f,\"psnr_v\":%.4f,\"psnr\":%.4f,"
+                        "\"ssim_y\":%.6f,\"ssim_u\":%.6f,\"ssim_v\":%.6f,\"ssim\":%.6f}"
+                      : "%.4f,%.4f,%.4f,%.4f,%.6f,%.6f,%.6f,%.6f\n",
+            psnr(score->sse[0], pixels[0]), psnr(score->sse[1], pixels[1]), psnr(score->sse[2], pixels[2]),
+            psnr(total_sse, total_pixels),
+            score->ssim[0], score->ssim[1], score->ssim[2], ssim_all);
+}
+
+int main(int argc, char *argv[]){
+    int ret = -1, opt, json = 0, current = 0, nb_frames;
+    long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int64_t total_frames = 0;
+    FILE *fds[2] = { NULL };
+    FILE *out = stdout;
+
+    FrameScore sum = { 0 };
+    CompareContext ctx = {
+        .width = 480,
+        .height = 272,
+        .batch_frames = 0,
+        .nb_threads = nb_cpus > 0 ? (nb_cpus < MAX_THREADS ? nb_cpus : MAX_THREADS) : 1,
+    };
+
+    ms_init(argv[0]);
+
+    //-w/-h frame size (sdlyuvplayer's 480x272 by default), -j threads, -b frames per batch, -J json
+    while((opt = getopt(argc, argv, "w:h:j:b:J")) != -1){
+        switch(opt){
+        case 'w': ctx.width = atoi(optarg); break;
+        case 'h': ctx.height = atoi(optarg); break;
+        case 'j': ctx.nb_threads = atoi(optarg); break;
+        case 'b': ctx.batch_frames = atoi(optarg); break;
+        case 'J': json = 1; break;
+        default: return -1;
+        }
+    }
+
+    if(argc - optind < 2 || ctx.width < 2 || ctx.height < 2 || (ctx.width | ctx.height) & 1 ||
+       ctx.nb_threads < 1 || ctx.nb_threads > MAX_THREADS){
+        fprintf(stderr, "usage: %s [-w width] [-h height] [-j threads] [-b batch] [-J] a.yuv b.yuv [out]\n", argv[0]);
+        return -1;
+    }
+
+    //same layout as yuv_frame_len in sdlyuvplayer: y plane then quarter size u and v
+    ctx.yuv_frame_len = (size_t)ctx.width * ctx.height * 12 / 8;
+    ctx.plane_width[0] = ctx.width;
+    ctx.plane_height[0] = ctx.height;
+    ctx.plane_width[1] = ctx.plane_width[2] = ctx.width / 2;
+    ctx.plane_height[1] = ctx.plane_height[2] = ctx.height / 2;
+    ctx.plane_offset[0] = 0;
+    ctx.plane_offset[1] = (size_t)ctx.width * ctx.height;
+    ctx.plane_offset[2] = ctx.plane_offset[1] + (size_t)ctx.width * ctx.height / 4;
+
+    if(ctx.batch_frames <= 0){
+        ctx.batch_frames = ctx.nb_threads * 4;
+    }
+
+    for(int i = 0; i < 2; i++){
+        fds[i] = fopen(argv[optind + i], "rb");
+        if(!fds[i]){
+            fprintf(stderr, "failed to open %s\n", argv[optind + i]);
+            goto __FAIL;
+        }
+        //batches are read whole, skip stdio's own copy
+        setvbuf(fds[i], NULL, _IONBF, 0);
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fileno(fds[i]), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    if(argc - optind > 2){
+        out = fopen(argv[optind + 2], "w");
+        if(!out){
+            fprintf(stderr, "failed to open %s\n", argv[optind + 2]);
+            out = stdout;
+            goto __FAIL;
+        }
+    }
+
+    for(int i = 0; i < 2; i++){
+        ctx.scores[i] = calloc(ctx.batch_frames, sizeof(*ctx.scores[i]));
+        for(int j = 0; j < 2; j++){
+            ctx.batch[i][j] = malloc(ctx.yuv_frame_len * ctx.batch_frames);
+            if(!ctx.batch[i][j]){
+                fprintf(stderr, "failed to allocate yuv frame buf\n");
+                goto __FAIL;
+            }
+        }
+        if(!ctx.scores[i]){
+            goto __FAIL;
+        }
+    }
+
+    dsp_init();
+
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.work_cond, NULL);
+    pthread_cond_init(&ctx.done_cond, NULL);
+
+    for(int i = 0; i < ctx.nb_threads; i++){
+        Worker *worker = &ctx.workers[i];
+
+        worker->ctx = &ctx;
+        worker->scratch = malloc(2 * (ctx.width / 4 + 1) * sizeof(*worker->scratch));
+        if(!worker->scratch || pthread_create(&worker->thread, NULL, worker_thread, worker)){
+            free(worker->scratch);
+            ctx.nb_threads = i;
+            goto __STOP;
+        }
+    }
+
+    fprintf(out, json ? "{\"width\":%d,\"height\":%d,\"frames\":[\n"
+                      : "frame,psnr_y,psnr_u,psnr_v,psnr,ssim_y,ssim_u,ssim_v,ssim\n",
+            ctx.width, ctx.height);
+
+    nb_frames = read_batch(&ctx, fds, current);
+    while(nb_frames > 0){
+        int next_frames;
+
+        //score this batch while the next one is read
+        dispatch(&ctx, current, nb_frames);
+        next_frames = read_batch(&ctx, fds, !current);
+        wait_done(&ctx);
+
+        for(int i = 0; i < nb_frames; i++){
+            const FrameScore *score = &ctx.scores[current][i];
+
+            if(json && total_frames){
+                fprintf(out, ",\n");
+            }
+            write_score(&ctx, out, json, total_frames++, score);
+            for(int p = 0; p < 3; p++){
+                sum.sse[p] += score->sse[p];
+                sum.ssim[p] += score->ssim[p];
+            }
+        }
+        ms_count(MS_FRAMES, nb_frames);
+        ms_tick();
+
+        current = !current;
+        nb_frames = next_frames;
+    }
+
+    if(json){
+        fprintf(out, "\n]");
+    }
+
+    if(total_frames > 0){
+        FrameScore average = sum;
+
+        for(int p = 0; p < 3; p++){
+            average.sse[p] = (sum.sse[p] + total_frames / 2) / total_frames;
+            average.ssim[p] = sum.ssim[p] / total_frames;
+        }
+
+        if(json){
+            fprintf(out, ",\"average\":");
+            write_score(&ctx, out, 1, -1, &average);
+        }else{
+            fprintf(stderr, "average over %lld frames: ", (long long)total_frames);
+            write_score(&ctx, stderr, 0, -1, &average);
+        }
+    }
+
+    if(json){
+        fprintf(out, "}\n");
+    }
+
+    ret = 0;
+
+__STOP:
+    pthread_mutex_lock(&ctx.lock);
+    ctx.quit = 1;
+    pthread_cond_broadcast(&ctx.work_cond);
+    pthread_mutex_unlock(&ctx.lock);
+
+    for(int i = 0; i < ctx.nb_threads; i++){
+        pthread_join(ctx.workers[i].thread, NULL);
+        free(ctx.workers[i].scratch);
+    }
+
+__FAIL:
+    for(int i = 0; i < 2; i++){
+        free(ctx.scores[i]);
+        free(ctx.batch[i][0]);
+        free(ctx.batch[i][1]);
+        if(fds[i]){
+            fclose(fds[i]);
+        }
+    }
+
+    if(out != stdout){
+        fclose(out);
+    }
+
+    return ret;
+}